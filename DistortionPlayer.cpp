@@ -13,23 +13,29 @@
 #include <math.h>
 #include <string.h>
 #include <unistd.h> // getpid, readlink, usleep
+#include <stdlib.h> // getenv
 #include <cerrno> // errno
 #include <utility> // make_pair
+#include <poll.h>
+#include <sys/inotify.h>
 #include "DistortionPlayer.h"
+#include "nv12convert.h"
+#ifdef _BINARY_SEARCH_TREE_
+#include <map>
+#endif
 
 #define MAX_QUE 5
-#define IMAGE_WIDTH 1280
-#define IMAGE_HEIGHT 720
-#define IMAGE_BUFSIZE 2764800 // RGB24: w*h*3 = 1280*720*3
-#define SCALE 3 // 2160/720  (4K resolution UHD: 3840 x 2160 pixels)
+// format of a webcamque surface, fixed when it is pushed
+#define SURFACE_RGB24 0
+#define SURFACE_NV12 1
+#define LENS_HEIGHT 2160 // the built-in samples are 4K UHD pixels (3840 x 2160)
+#define MAX_IMAGE_SIZE 8192 // width or height, remap entries are 16 bits
 
-#define PLAYBACK_EVENT (SDL_USEREVENT + 100)
 #define PLAYBACK_FRAME_RATE 25 // PAL 25 fps
-#define DISTORTION_GAP_TIME 100
-
-#define SCREEN_WIDTH 1920 //1600 //1920          //3840 //2560 //1280
-#define SCREEN_HEIGHT 1080 //900 //1080         //2160 // 1440 //720
-#define SCREEN_BUFSIZE 6220800 //4320000 //6220800   //24883200 //11059200 //2764800  RGB24
+#define QUEUE_WAIT_TIME 100 // milliseconds, threads notice pause/stop at least this often
+#define CALIBRATION_EVENT_SIZE 4096 // inotify read buffer, a few events
+#define REMAP_CACHE_ENV "UVD_REMAP_CACHE"
+#define REMAP_CACHE_HOME_DIR ".cache/uvdclient" // under $HOME
 
 #ifndef min
 #define min(a,b) (((a) < (b)) ? (a) : (b))
@@ -47,12 +53,6 @@ enum Axis
     AXIS_Y
 };
 
-struct MapEntry
-{
-    float first;
-    float second;
-};
-
 struct Pic
 {
     unsigned char *buf;
@@ -127,28 +127,49 @@ struct ArgbColor
 
 void *DistortionProcess(void *context);
 void *PlaybackVideo(void *context);
+void *CalibrationWatch(void *context);
 
 
-DistortionPlayer::DistortionPlayer(int workmode)
- : webcamque(MAX_QUE, IMAGE_BUFSIZE),
-   distortionque(MAX_QUE, SCREEN_BUFSIZE),
+DistortionPlayer::DistortionPlayer(int workmode, int imagew, int imageh, int screenw, int screenh)
+ : webcamque(MAX_QUE, imagew * imageh * 3), // RGB24 when not fused, NV12 fits too
+   distortionque(MAX_QUE, screenw * screenh * 3),
    distortion_thread(DistortionProcess, this),
-   playback_thread(PlaybackVideo, this)
+   playback_thread(PlaybackVideo, this),
+   calibration_thread(CalibrationWatch, this)
 {
     // init members
     mode = workmode;
-    image_width = IMAGE_WIDTH;
-    image_height = IMAGE_HEIGHT;
-    screen_width = SCREEN_WIDTH;
-    screen_height = SCREEN_HEIGHT;
+    image_width = imagew;
+    image_height = imageh;
+    screen_width = screenw;
+    screen_height = screenh;
+
+    calibration_path[0] = '\0';
+    calibration_name = calibration_path;
+    calibration_fd = -1;
+    calibration_cb = NULL;
+    calibration_ctx = NULL;
+
+    // just a path, nothing is read before the first frame
+    const char *cachedir = getenv(REMAP_CACHE_ENV);
+    if(cachedir != NULL)
+        remap_cache.SetDir(cachedir);
+    else if((cachedir = getenv("HOME")) != NULL)
+    {
+        char path[PATH_MAX];
+        if(snprintf(path, sizeof(path), "%s/" REMAP_CACHE_HOME_DIR, cachedir) < (int)sizeof(path))
+            remap_cache.SetDir(path);
+    }
 
     InitDistortionMap();
 
     //... add anything else later ...
-    rgbtmpbuf.resize(IMAGE_BUFSIZE);
+    fused.store(true);
+    nv12_rows.resize((size_t)screen_width * 3 * MAX_WORKER);
+    SetThreadCount(sysconf(_SC_NPROCESSORS_ONLN));
 
     playback_time = 1000 / PLAYBACK_FRAME_RATE;
-    distortion_gap_time = DISTORTION_GAP_TIME;
+    queue_wait_time = QUEUE_WAIT_TIME;
 
     // create sdl window
     sdlwnd = NULL;
@@ -168,9 +189,15 @@ DistortionPlayer::DistortionPlayer(int workmode)
 
 DistortionPlayer::~DistortionPlayer()
 {
+    stop_watching();
+
     // stop working threads
     if(mode == ASYNCHRO || mode == PLAYERWND)
     {
+        distortion_thread.quit();
+        playback_thread.quit();
+        webcamque.Wakeup();
+        distortionque.Wakeup();
         distortion_thread.stop();
         playback_thread.stop();
     }
@@ -178,6 +205,16 @@ DistortionPlayer::~DistortionPlayer()
     // destory sdl window
     if(mode == PLAYERWND)
         DestroySDLWindow();
+
+    // release remap tables
+    remap_tables.clear();
+
+    for(size_t k = 0; k < ruler_grids.size(); k++)
+        delete ruler_grids[k];
+    ruler_grids.clear();
+    for(size_t k = 0; k < retired_rulers.size(); k++)
+        delete retired_rulers[k];
+    retired_rulers.clear();
 }
 
 bool DistortionPlayer::CreateSDLWindow()
@@ -250,8 +287,17 @@ bool DistortionPlayer::CorrectImage(unsigned char *src_buf,
                                     int dst_width,
                                     int dst_height)
 {
-    if(NULL == src_buf || NULL == dst_buf)
-        return false;
+    if(NULL == src_buf || NULL == dst_buf || src_width < 2 || src_height < 2 || dst_width <= 0 || dst_height <= 0)
+        return false; // a bilinear block needs 2x2 source pixels
+
+    if(fused.load())
+    {
+        distortion_correction_nv12(src_buf, src_width, src_height, dst_buf, dst_width, dst_height, REVERSE);
+        return true;
+    }
+
+    if(rgbtmpbuf.size() < (size_t)(src_width * src_height * 3))
+        rgbtmpbuf.resize(src_width * src_height * 3);
     NV12_to_RGB24(src_buf, &rgbtmpbuf[0], src_width, src_height);
     distortion_correction(&rgbtmpbuf[0], src_width, src_height, dst_buf, dst_width, dst_height, REVERSE);
     return true;
@@ -264,8 +310,8 @@ bool DistortionPlayer::CorrectImageRGB(unsigned char *src_buf,
                                       int dst_width,
                                       int dst_height)
 {
-    if(NULL == src_buf || NULL == dst_buf)
-        return false;
+    if(NULL == src_buf || NULL == dst_buf || src_width < 2 || src_height < 2 || dst_width <= 0 || dst_height <= 0)
+        return false; // a bilinear block needs 2x2 source pixels
     distortion_correction(src_buf, src_width, src_height, dst_buf, dst_width, dst_height, REVERSE);
     return true;
 }
@@ -277,8 +323,8 @@ bool DistortionPlayer::DistortImageRGB(unsigned char *src_buf,
                                       int dst_width,
                                       int dst_height)
 {
-    if(NULL == src_buf || NULL == dst_buf)
-        return false;
+    if(NULL == src_buf || NULL == dst_buf || src_width < 2 || src_height < 2 || dst_width <= 0 || dst_height <= 0)
+        return false; // a bilinear block needs 2x2 source pixels
     distortion_correction(src_buf, src_width, src_height, dst_buf, dst_width, dst_height, FORWARD);
     return true;
 }
@@ -315,6 +361,48 @@ bool DistortionPlayer::DistortYLine(unsigned char *buf, int pos, int pixelwidth,
     return true;
 }
 
+bool DistortionPlayer::CorrectPoint(float sx, float sy, int src_width, int src_height, int dst_width, int dst_height, MapPoint *pt)
+{
+    std::shared_ptr<const LensModel> model = current_lens();
+
+    return correct_point(*model, sx, sy, src_width, src_height, dst_width, dst_height, pt);
+}
+
+int DistortionPlayer::CorrectPolyline(const MapPoint *pts, int n, bool closed, float step,
+                                      int src_width, int src_height, int dst_width, int dst_height,
+                                      std::vector<MapPoint> &out)
+{
+    MapPoint pt;
+    int edges = closed ? n : n - 1;
+    std::shared_ptr<const LensModel> model = current_lens(); // one calibration for the whole line
+
+    out.clear();
+    if(NULL == pts || n <= 0)
+        return 0;
+    if(step < 1.0F)
+        step = 1.0F;
+
+    correct_point(*model, pts[0].x, pts[0].y, src_width, src_height, dst_width, dst_height, &pt);
+    out.push_back(pt);
+
+    for(int k = 0; k < edges; k++)
+    {
+        const MapPoint &a = pts[k];
+        const MapPoint &b = pts[(k + 1) % n];
+        int samples = (int)(Pythagorean(b.x - a.x, b.y - a.y) / step) + 1;
+
+        for(int i = 1; i <= samples; i++)
+        {
+            float t = (float)i / samples;
+            correct_point(*model, a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+                          src_width, src_height, dst_width, dst_height, &pt);
+            out.push_back(pt);
+        }
+    }
+
+    return out.size();
+}
+
 bool DistortionPlayer::PushImage(unsigned char *buf)
 {
     /*// Active dropping frame ???
@@ -331,17 +419,37 @@ bool DistortionPlayer::PushImage(unsigned char *buf)
         return false;
     }
 
-    if(!NV12_to_RGB24(buf, surface, image_width, image_height))
+    // fused: keep NV12, the distortion thread samples it directly,
+    // the format goes with the surface, SetFusedMode() only affects later frames
+    bool nv12 = fused.load();
+    if(nv12)
+        memcpy(surface, buf, image_width * image_height * 3 / 2);
+    else if(!NV12_to_RGB24(buf, surface, image_width, image_height))
     {
         printf("error: failed to convert nv12 to rgb24!\n");
         return false;
     }
 
-    webcamque.Enque(surface);
+    webcamque.Enque(surface, nv12 ? SURFACE_NV12 : SURFACE_RGB24);
 
     return true;
 }
 
+bool DistortionPlayer::SetThreadCount(int n)
+{
+    return workers.SetThreadCount(n);
+}
+
+int DistortionPlayer::GetThreadCount()
+{
+    return workers.GetThreadCount();
+}
+
+void DistortionPlayer::SetFusedMode(bool on)
+{
+    fused.store(on);
+}
+
 void DistortionPlayer::Play()
 {
     distortion_thread.resume();
@@ -352,35 +460,150 @@ void DistortionPlayer::Pause()
 {
     distortion_thread.suspend();
     playback_thread.suspend();
+    // let blocked threads park right now
+    webcamque.Wakeup();
+    distortionque.Wakeup();
+}
+
+bool DistortionPlayer::LoadCalibration(const char *path)
+{
+    LensCalibration calib;
+
+    if(NULL == path)
+        return false;
+
+    Autolock lock(&calibration_mtx);
+    unsigned long tick = GetTickCount();
+
+    if(!calib.Load(path) || !apply_calibration(calib))
+    {
+        printf("error: lens calibration %s not applied, keep the current one\n", path);
+        return false;
+    }
+    calibration = calib; // for a later SetGeometry
+
+    printf("info: lens calibration %s, %d points, generation %u cost %u\n",
+            path, calib.GetCount(), GetCalibrationGeneration(), (unsigned int)(GetTickCount() - tick));
+    return true;
+}
+
+bool DistortionPlayer::WatchCalibration(const char *path, CALIBRATION_CB cb, void *ctx)
+{
+    char dir[PATH_MAX];
+    const char *slash;
+
+    if(NULL == path || strlen(path) >= sizeof(calibration_path))
+        return false;
+
+    stop_watching();
+
+    // editors save by renaming a new file over the old one, so watch the
+    // directory rather than the file
+    strcpy(calibration_path, path);
+    slash = strrchr(calibration_path, '/');
+    calibration_name = (slash != NULL) ? slash + 1 : calibration_path;
+    if(slash == NULL)
+        strcpy(dir, ".");
+    else if(slash == calibration_path)
+        strcpy(dir, "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - calibration_path), calibration_path);
+
+    calibration_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(calibration_fd < 0)
+    {
+        printf("error: failed to init inotify, errno=%d\n", errno);
+        return false;
+    }
+
+    if(inotify_add_watch(calibration_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        printf("error: failed to watch %s, errno=%d\n", dir, errno);
+        close(calibration_fd);
+        calibration_fd = -1;
+        return false;
+    }
+
+    calibration_cb = cb;
+    calibration_ctx = ctx;
+    if(!calibration_thread.start())
+    {
+        close(calibration_fd);
+        calibration_fd = -1;
+        return false;
+    }
+    calibration_thread.resume();
+
+    printf("info: watching lens calibration %s\n", calibration_path);
+    return true;
+}
+
+unsigned int DistortionPlayer::GetCalibrationGeneration()
+{
+    return current_lens()->generation;
+}
+
+bool DistortionPlayer::SetGeometry(int imagew, int imageh, int screenw, int screenh)
+{
+    if(mode != BLOCKING)
+    {
+        printf("error: geometry of a running player is fixed, pass it to the constructor\n");
+        return false;
+    }
+    if(imagew < 2 || imageh < 2 || screenw < 2 || screenh < 2 ||
+       imagew > MAX_IMAGE_SIZE || imageh > MAX_IMAGE_SIZE || screenw > MAX_IMAGE_SIZE || screenh > MAX_IMAGE_SIZE)
+    {
+        printf("error: bad geometry %dx%d -> %dx%d\n", imagew, imageh, screenw, screenh);
+        return false;
+    }
+
+    Autolock lock(&calibration_mtx);
+    int old_height = image_height;
+
+    image_width = imagew;
+    image_height = imageh;
+    screen_width = screenw;
+    screen_height = screenh;
+
+    // lookups in native pixels, tables of this size come out exact
+    if(imageh != old_height && !apply_calibration(calibration))
+        return false;
+
+    printf("info: geometry %dx%d -> %dx%d\n", imagew, imageh, screenw, screenh);
+    return true;
+}
+
+void DistortionPlayer::stop_watching()
+{
+    if(calibration_fd < 0)
+        return;
+
+    calibration_thread.stop(); // wakes up from poll within queue_wait_time
+    close(calibration_fd);
+    calibration_fd = -1;
 }
 
 void *DistortionProcess(void *context)
 {
     DistortionPlayer *thisptr = (DistortionPlayer *)context;
-    SDL_Event event;
     unsigned long tick1, tick2;
     static unsigned int i = 0;
-    struct timeval tv;
     unsigned char *buf = NULL;
     unsigned char *surface = NULL;
 
+    // sleep until a webcam buffer is pushed, idle camera is not an error
+    if((buf = thisptr->webcamque.WaitDequeSurface(thisptr->queue_wait_time)) == NULL)
+        return NULL; // timeout or wakeup, the thread loop checks pause/stop
+
     ++i;
     tick1 = thisptr->GetTickCount();
 
-    // get a webcam buffer
-    while((buf = thisptr->webcamque.GetDequeSurface()) == NULL)
-    {
-        printf("warning: no any webcam image to process...\n");
-        tv.tv_sec = 0;
-        tv.tv_usec = thisptr->distortion_gap_time;
-        select(0, NULL, NULL, NULL, &tv);
-    }
-
-    // get a distortion surface
-    while((surface = thisptr->distortionque.GetEnqueSurface()) == NULL)
+    // get a distortion surface, only playback may deque from it
+    if((surface = thisptr->distortionque.WaitEnqueSurface(thisptr->playback_time)) == NULL)
     {
-        thisptr->distortionque.Deque(); // drop one frame not played
-        printf("warning: dropping unplayed frame at %u, Playback is stuck or too slow~\n", i);
+        thisptr->webcamque.Deque(); // drop the webcam frame instead
+        printf("warning: dropping webcam frame at %u, Playback is stuck or too slow~\n", i);
+        return NULL;
     }
 
     tick2 = thisptr->GetTickCount();
@@ -389,24 +612,27 @@ void *DistortionProcess(void *context)
     if(buf != NULL && surface != NULL)
     {
         // do convert
-        thisptr->distortion_correction(buf,
-            thisptr->image_width,
-            thisptr->image_height,
-            surface,
-            thisptr->screen_width,
-            thisptr->screen_height,
-            REVERSE);
+        if(thisptr->webcamque.GetDequeTag() == SURFACE_NV12)
+            thisptr->distortion_correction_nv12(buf,
+                thisptr->image_width,
+                thisptr->image_height,
+                surface,
+                thisptr->screen_width,
+                thisptr->screen_height,
+                REVERSE);
+        else
+            thisptr->distortion_correction(buf,
+                thisptr->image_width,
+                thisptr->image_height,
+                surface,
+                thisptr->screen_width,
+                thisptr->screen_height,
+                REVERSE);
 
         // release webcam que surface
         thisptr->webcamque.Deque();
-        // release distortion que surface
+        // release distortion que surface, wakes up playback
         thisptr->distortionque.Enque(surface);
-        // send play event
-        if(thisptr->mode == PLAYERWND)
-        {
-            event.type = PLAYBACK_EVENT;
-            SDL_PushEvent(&event);
-        }
     }
 
     // statistics of CPU time
@@ -423,33 +649,11 @@ void *PlaybackVideo(void *context)
     DistortionPlayer *thisptr = (DistortionPlayer *)context;
     int pitch = 0;
     unsigned char *buf = NULL;
-    SDL_Event event;
     SDL_Rect target_rect;
-    int ret;
 
-    //ret = SDL_WaitEvent(&event);
-    while(ret = SDL_WaitEventTimeout(&event, thisptr->playback_time))
-    {
-        if(ret == 1)
-        {
-            if(event.type == PLAYBACK_EVENT)
-                break;
-            else
-            {
-                printf("warning: received unkonwn SDL event: %d\n", event.type);
-                continue;
-            }
-        }
-        else // 0
-        {
-            printf("failed to wait SDL event or timeout: %s\n", SDL_GetError());
-            break;
-        }
-    }
-
-    // try to get a corrected frame
+    // sleep until a corrected frame is ready
     // consider timestamp ? - expending buffer structure
-    if((buf = thisptr->distortionque.GetDequeSurface()) != NULL)
+    if((buf = thisptr->distortionque.WaitDequeSurface(thisptr->queue_wait_time)) != NULL)
     {
         pitch = thisptr->screen_width * 3; // window may resize
 
@@ -471,6 +675,98 @@ void *PlaybackVideo(void *context)
     return NULL;
 }
 
+/*
+ * Wait for the calibration file to be written, then load it on this
+ * thread, the video pipeline keeps the old tables until the swap
+ */
+void *CalibrationWatch(void *context)
+{
+    DistortionPlayer *thisptr = (DistortionPlayer *)context;
+    char events[CALIBRATION_EVENT_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd;
+    bool changed = false;
+    ssize_t len;
+
+    pfd.fd = thisptr->calibration_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    // timeout: the thread loop checks stop
+    if(poll(&pfd, 1, thisptr->queue_wait_time) <= 0)
+        return NULL;
+
+    while((len = read(thisptr->calibration_fd, events, sizeof(events))) > 0)
+    {
+        for(char *p = events; p < events + len; )
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if(ev->len > 0 && strcmp(ev->name, thisptr->calibration_name) == 0)
+                changed = true;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    // several events of one save make one reload
+    if(changed && thisptr->LoadCalibration(thisptr->calibration_path) && thisptr->calibration_cb != NULL)
+        (*thisptr->calibration_cb)(thisptr->calibration_ctx);
+
+    return NULL;
+}
+
+#if defined(_BINARY_SEARCH_TREE_) && !defined(_RADIAL_MODEL_)
+/*
+ * Radius lookup backends side by side: std::map walk (the original one),
+ * implicit search tree and bucket table, same random radii for all
+ */
+static void benchmark_radial_lookup(const float *keys, const float *values, int n)
+{
+    const int COUNT = 1 << 18;
+    std::map<float, float> rallymap;
+    std::map<float, float>::iterator itlow, itup;
+    BinarySearchTree tree;
+    RadialLut lut;
+    std::vector<float> radius(COUNT);
+    struct timeval t0, t1, t2, t3;
+    float sum[3] = {0.0F, 0.0F, 0.0F};
+    int i;
+
+    for(i = 0; i < n; i++)
+        rallymap.insert(std::pair<float, float>(keys[i], values[i]));
+    tree.init(keys, values, n);
+    lut.init(keys, values, n);
+
+    srand(1);
+    for(i = 0; i < COUNT; i++)
+        radius[i] = keys[n-1] * (rand() & 0xffff) / 0x10000;
+
+    gettimeofday(&t0, NULL);
+    for(i = 0; i < COUNT; i++)
+    {
+        itup = rallymap.upper_bound(radius[i]);
+        if(itup == rallymap.begin())
+            itup++;
+        if(itup == rallymap.end())
+            itup--;
+        itlow = itup;
+        itlow--;
+        sum[0] += (itup->second * (radius[i] - itlow->first) + itlow->second * (itup->first - radius[i])) / (itup->first - itlow->first);
+    }
+    gettimeofday(&t1, NULL);
+    for(i = 0; i < COUNT; i++)
+        sum[1] += tree.Map(radius[i]);
+    gettimeofday(&t2, NULL);
+    for(i = 0; i < COUNT; i++)
+        sum[2] += lut.Map(radius[i]);
+    gettimeofday(&t3, NULL);
+
+    #define ELAPSED_NS(a, b) (((b).tv_sec - (a).tv_sec) * 1e9 + ((b).tv_usec - (a).tv_usec) * 1e3)
+    printf("info: %d radius lookups, std::map %.1f ns, search tree %.1f ns, bucket table %.1f ns%s\n",
+           COUNT, ELAPSED_NS(t0, t1) / COUNT, ELAPSED_NS(t1, t2) / COUNT, ELAPSED_NS(t2, t3) / COUNT,
+           (sum[0] == sum[1] && sum[1] == sum[2]) ? "" : ", RESULTS DIFFER");
+    #undef ELAPSED_NS
+}
+#endif
+
 bool DistortionPlayer::InitDistortionMap()
 {
     float A[] = {
@@ -579,89 +875,292 @@ bool DistortionPlayer::InitDistortionMap()
         2391.998488, 4246.378565
     };
 
-    int i;
-    int N = sizeof(A) / sizeof(float);
+    std::shared_ptr<LensModel> model;
+
+    // built-in lens, until a calibration file is loaded
+    if(!calibration.init(A, sizeof(A) / sizeof(float) / 2, LENS_HEIGHT) ||
+       !(model = build_lens(calibration, image_height)))
+        return false;
+
+    model->generation = 0;
+    std::atomic_store(&lens, std::shared_ptr<const LensModel>(model));
+    return true;
+}
+
+/*
+ * Both radius lookups of a calibration in pixels of an image height
+ * pixels high, not published yet
+ *  returns:  NULL if the curve does not make a lookup
+ */
+std::shared_ptr<LensModel> DistortionPlayer::build_lens(const LensCalibration &calib, int height)
+{
+    std::shared_ptr<LensModel> model(new LensModel());
     std::vector<float> first;
     std::vector<float> second;
+    int N = calib.GetCount();
+
+    model->height = height;
+    calib.GetRadii(height, first, second);
+    if(!model->forward.init(&first[0], &second[0], N) ||
+       !model->reverse.init(&second[0], &first[0], N))
+        return std::shared_ptr<LensModel>();
+
+    // same samples through the same lookup give the same tables
+    model->key = RemapCache::Hash(RADIAL_LOOKUP_NAME, strlen(RADIAL_LOOKUP_NAME));
+    model->key = RemapCache::Hash(&first[0], N * sizeof(float), model->key);
+    model->key = RemapCache::Hash(&second[0], N * sizeof(float), model->key);
+    model->key = RemapCache::Hash(&height, sizeof(height), model->key);
+
+#if defined(_RADIAL_MODEL_)
+    model->forward.Report("forward", &first[0], &second[0], N);
+    model->reverse.Report("reverse", &second[0], &first[0], N);
+#elif defined(_BINARY_SEARCH_TREE_)
+    printf("Tree depth: %d\n", model->forward.Depth());
+    benchmark_radial_lookup(&first[0], &second[0], N);
+#endif
 
-    N /= 2;
-    first.resize(N);
-    second.resize(N);
+    return model;
+}
+
+std::shared_ptr<const LensModel> DistortionPlayer::current_lens()
+{
+    return std::atomic_load(&lens);
+}
+
+/*
+ * Rebuild what the current calibration has built, off the frame path,
+ * then swap curve and tables in one step under remap_mtx, a frame takes
+ * its table once so it is corrected by either the old or the new lens
+ */
+bool DistortionPlayer::apply_calibration(const LensCalibration &calib)
+{
+    std::vector<std::shared_ptr<const RemapTable> > tables; // released after the locks
+    std::shared_ptr<LensModel> model = build_lens(calib, image_height);
+    size_t k;
+
+    if(!model)
+        return false;
 
-    for(i = 0; i < N; i++)
     {
-        first[i] = A[i*2]/SCALE;
-        second[i] = A[i*2+1]/SCALE;
+        Autolock lock(&remap_mtx);
+        for(k = 0; k < remap_tables.size(); k++)
+            tables.push_back(remap_tables[k]);
     }
 
-#ifdef _BINARY_SEARCH_TREE_
-    distortion_tree.SmartInsert(&second[0], &first[0], N);
-    reverse_distortion_tree.SmartInsert(&first[0], &second[0], N);
-    printf("Tree depth: %d\n", distortion_tree.Depth());
-    distortion_tree.Draw();
-#endif
-
-    for(i = 0; i < N; i++)
+    for(k = 0; k < tables.size(); k++)
     {
-        distortion_map.insert(std::pair<float, float>(first[i], second[i]));
-        reverse_distortion_map.insert(std::pair<float, float>(second[i], first[i]));
+        const RemapTable *old = tables[k].get();
+        tables[k] = std::shared_ptr<const RemapTable>(
+            make_remap_table(*model, old->src_w, old->src_h, old->dst_w, old->dst_h, old->maptype));
     }
 
+    Autolock ruler_lock(&ruler_mtx);
+    Autolock lock(&remap_mtx);
+
+    // a geometry first asked for in between was built with the old lens
+    // and is dropped, the next frame of it builds it again
+    model->generation = lens->generation + 1;
+    std::atomic_store(&lens, std::shared_ptr<const LensModel>(model));
+    remap_tables.swap(tables);
+
+    // grids are built on demand, the old ones stay alive for their holders
+    // until the next reload, by then they have seen the generation move
+    for(k = 0; k < retired_rulers.size(); k++)
+        delete retired_rulers[k];
+    retired_rulers.swap(ruler_grids);
+    ruler_grids.clear();
+
     return true;
 }
 
-void BilinearInterpolation(unsigned char *dst, Pic &src)
+/*
+ * Blend one RGB24 pixel from a 2x2 source block
+ *  8-bit pixels times weights summing up to 256 stay inside 16 bits,
+ *  the result is rounded and masked to black when there is no source pixel
+ */
+inline void BilinearGather(unsigned char *dst, const unsigned char *src, int pitch, const RemapEntry &e)
 {
-    int x1, x2;
-    int y1, y2;
-    //float coeff;
-    float k[4];
-
-    // source image coordinate translation
-    float x = src.x + src.ox;
-    float y = src.y + src.oy;
-
-    if(x < 0 || x > src.w || y < 0 || y > src.h)
-        return; // out of range
-
-    x1 = (int)x; // x1 must be less than x
-    x2 = x1 +1;
-
-    y1 = (int)y;
-    y2 = y1 + 1;
-
-    //coeff = 1.0 / ((x2 - x1) * (y2 - y1));
-    k[0] = (x2 - x) * (y2 - y);
-    k[1] = (x - x1) * (y2 - y);
-    k[2] = (x2 - x) * (y - y1);
-    k[3] = (x - x1) * (y - y1);
-
-    //r = coeff*(src[pitch*y1+3*x1]*k[0] + src[pitch*y1+3*x2]*k[1] + src[pitch*y2+3*x1]*k[2] + src[pitch*y2+3*x2]*k[3]);
-    dst[0] = src.buf[src.pitch*y1+3*x1]*k[0] + src.buf[src.pitch*y1+3*x2]*k[1] + src.buf[src.pitch*y2+3*x1]*k[2] + src.buf[src.pitch*y2+3*x2]*k[3];
-    dst[1] = src.buf[src.pitch*y1+3*x1+1]*k[0] + src.buf[src.pitch*y1+3*x2+1]*k[1] + src.buf[src.pitch*y2+3*x1+1]*k[2] + src.buf[src.pitch*y2+3*x2+1]*k[3];
-    dst[2] = src.buf[src.pitch*y1+3*x1+2]*k[0] + src.buf[src.pitch*y1+3*x2+2]*k[1] + src.buf[src.pitch*y2+3*x1+2]*k[2] + src.buf[src.pitch*y2+3*x2+2]*k[3];
+    const unsigned char *p0 = src + pitch * e.y + 3 * e.x; // top row of the block
+    const unsigned char *p1 = p0 + pitch; // bottom row of the block
+    const unsigned int w00 = REMAP_WEIGHT_ONE - e.w01 - e.w10 - e.w11;
+    const unsigned int round = REMAP_WEIGHT_ONE / 2;
+
+    dst[0] = ((p0[0]*w00 + p0[3]*e.w01 + p1[0]*e.w10 + p1[3]*e.w11 + round) >> REMAP_WEIGHT_BITS) & e.mask;
+    dst[1] = ((p0[1]*w00 + p0[4]*e.w01 + p1[1]*e.w10 + p1[4]*e.w11 + round) >> REMAP_WEIGHT_BITS) & e.mask;
+    dst[2] = ((p0[2]*w00 + p0[5]*e.w01 + p1[2]*e.w10 + p1[5]*e.w11 + round) >> REMAP_WEIGHT_BITS) & e.mask;
 }
 
-void DistortionPlayer::distortion_correction(unsigned char *src_buf, int src_w, int src_h, unsigned char *dst_buf, int dst_w, int dst_h, int maptype)
+/*
+ * A correction job for the worker pool, bands are rows of the destination
+ */
+struct GatherJob
+{
+    const RemapTable *table;
+    const unsigned char *src;
+    unsigned char *dst;
+    unsigned char *rows; // NV12: dst_w * 3 bytes of scratch per band
+};
+
+void GatherRGBBand(void *ctx, int /* band */, int row_begin, int row_end)
 {
+    GatherJob *job = (GatherJob *)ctx;
+    const int dst_w = job->table->dst_w;
+    const int pitch = job->table->src_w * 3; // RGB24
+    const RemapEntry *entry = &job->table->entries[0];
+    int i;
+
+    // gather source pixels through the table, every pixel is written
+    for(i = row_begin * dst_w; i < row_end * dst_w; i++)
+        BilinearGather(&job->dst[3*i], job->src, pitch, entry[i]);
+}
+
+void GatherNV12Band(void *ctx, int band, int row_begin, int row_end)
+{
+    GatherJob *job = (GatherJob *)ctx;
+    const int src_w = job->table->src_w;
+    const int src_h = job->table->src_h;
+    const int dst_w = job->table->dst_w;
+    const unsigned char *yData = job->src;
+    const unsigned char *uvData = job->src + src_w * src_h;
+    const unsigned int round = REMAP_WEIGHT_ONE / 2;
     int i, j;
+
+    // one row of blended y and u,v, converted to RGB24 in place of dst
+    unsigned char *yrow = job->rows + (size_t)band * dst_w * 3;
+    unsigned char *uvrow = yrow + dst_w;
+
+    for(i = row_begin; i < row_end; i++)
+    {
+        const RemapEntry *entry = &job->table->entries[i * dst_w];
+        unsigned char *out = &job->dst[i * dst_w * 3];
+
+        // blend luma of the 2x2 block
+        for(j = 0; j < dst_w; j++)
+        {
+            const RemapEntry &e = entry[j];
+            const unsigned char *y0 = yData + src_w * e.y + e.x;
+            const unsigned char *y1 = y0 + src_w;
+            const unsigned int w00 = REMAP_WEIGHT_ONE - e.w01 - e.w10 - e.w11;
+
+            yrow[j] = (y0[0]*w00 + y0[1]*e.w01 + y1[0]*e.w10 + y1[1]*e.w11 + round) >> REMAP_WEIGHT_BITS;
+        }
+
+        // chroma is half resolution, take the pair under the pixel
+        // nearest to the sample point
+        for(j = 0; j < dst_w; j++)
+        {
+            const RemapEntry &e = entry[j];
+            const int cx = e.x + ((e.w01 + e.w11 + round) >> REMAP_WEIGHT_BITS);
+            const int cy = e.y + ((e.w10 + e.w11 + round) >> REMAP_WEIGHT_BITS);
+            const unsigned char *c = uvData + src_w * (cy >> 1) + (cx & ~1);
+
+            uvrow[2*j] = c[0];
+            uvrow[2*j+1] = c[1];
+        }
+
+        yuv444_to_rgb24_row(yrow, uvrow, out, dst_w);
+
+        // no source pixel: black
+        for(j = 0; j < dst_w; j++)
+        {
+            out[3*j] &= entry[j].mask;
+            out[3*j+1] &= entry[j].mask;
+            out[3*j+2] &= entry[j].mask;
+        }
+    }
+}
+
+void DistortionPlayer::distortion_correction(unsigned char *src_buf, int src_w, int src_h, unsigned char *dst_buf, int dst_w, int dst_h, int maptype)
+{
+    std::shared_ptr<const RemapTable> table = get_remap_table(src_w, src_h, dst_w, dst_h, maptype); // held to the end of the frame
+    GatherJob job;
+    job.table = table.get();
+    job.src = src_buf;
+    job.dst = dst_buf;
+    job.rows = NULL;
+
+    workers.Run(GatherRGBBand, &job, dst_h);
+}
+
+void DistortionPlayer::distortion_correction_nv12(unsigned char *src_buf, int src_w, int src_h, unsigned char *dst_buf, int dst_w, int dst_h, int maptype)
+{
+    std::shared_ptr<const RemapTable> table = get_remap_table(src_w, src_h, dst_w, dst_h, maptype); // held to the end of the frame
+    GatherJob job;
+    job.table = table.get();
+    job.src = src_buf;
+    job.dst = dst_buf;
+
+    // sized for the screen at start, only a bigger CorrectImage target grows it
+    Autolock lock(&nv12_rows_mtx);
+    if(nv12_rows.size() < (size_t)dst_w * 3 * MAX_WORKER)
+        nv12_rows.resize((size_t)dst_w * 3 * MAX_WORKER);
+    job.rows = &nv12_rows[0];
+
+    workers.Run(GatherNV12Band, &job, dst_h);
+}
+
+std::shared_ptr<const RemapTable> DistortionPlayer::get_remap_table(int src_w, int src_h, int dst_w, int dst_h, int maptype)
+{
+    Autolock lock(&remap_mtx);
+    size_t k;
+
+    for(k = 0; k < remap_tables.size(); k++)
+    {
+        if(remap_tables[k]->Match(src_w, src_h, dst_w, dst_h, maptype))
+            return remap_tables[k];
+    }
+
+    // first time for this geometry, the table lives until the next
+    // calibration and the last frame using it
+    RemapTable *table = make_remap_table(*lens, src_w, src_h, dst_w, dst_h, maptype); // lens only changes under remap_mtx
+    remap_tables.push_back(std::shared_ptr<const RemapTable>(table));
+
+    return remap_tables.back();
+}
+
+/*
+ * Map the table from the cache, or build it and store it for the next launch
+ */
+RemapTable *DistortionPlayer::make_remap_table(const LensModel &model, int src_w, int src_h, int dst_w, int dst_h, int maptype)
+{
+    uint64_t key = RemapCache::Key(model.key, src_w, src_h, dst_w, dst_h, maptype);
+    unsigned long tick = GetTickCount();
+    RemapTable *table = remap_cache.Load(key, src_w, src_h, dst_w, dst_h, maptype);
+
+    if(table != NULL)
+    {
+        printf("info: map remap table %dx%d -> %dx%d type %d from cache cost %u\n",
+                src_w, src_h, dst_w, dst_h, maptype, (unsigned int)(GetTickCount() - tick));
+        return table;
+    }
+
+    table = new RemapTable(src_w, src_h, dst_w, dst_h, maptype);
+    build_remap_table(model, table);
+    printf("info: build remap table %dx%d -> %dx%d type %d cost %u\n",
+            src_w, src_h, dst_w, dst_h, maptype, (unsigned int)(GetTickCount() - tick));
+
+    remap_cache.Store(key, *table);
+    return table;
+}
+
+void DistortionPlayer::build_remap_table(const LensModel &model, RemapTable *table)
+{
+    int i, j, k;
     float slope;
-    std::map<float, float>::iterator itlow, itup;
-    std::map<float, float>& rallymap = (maptype == FORWARD) ? distortion_map : reverse_distortion_map;
-    struct MapEntry low, up;
+    const RadialLookup &lut = model.Lookup(table->maptype);
 
-    std::map<float, float>::iterator itlasthit = rallymap.end(); // initial
-    bool positive = false;
+    // radii of the lookup are pixels of its camera height, 1 at native size
+    float unit = model.Unit(table->maptype == REVERSE ? table->src_h : table->dst_h);
 
-    struct Pic src(src_buf, src_w, src_h), dst(dst_buf, dst_w, dst_h);
+    struct Pic src(NULL, table->src_w, table->src_h), dst(NULL, table->dst_w, table->dst_h);
     int half_dw = dst.w / 2;
     int half_dh = dst.h / 2;
 
-    memset(&low, 0, sizeof(low));
-    memset(&up, 0, sizeof(up));
-    memset(dst.buf, 0, dst.pitch*dst.h); // init 0
+    // source coordinates of the four symmetry points
+    float qx[4], qy[4];
+    int px[4], py[4];
 
-    // look up table and translate pixels
+    // look up table for a quarter, the others are symmetry points
     for(i = 0; i < half_dh; i++)// dh
     {
         for(j = 0; j < half_dw; j++) // dw
@@ -673,129 +1172,105 @@ void DistortionPlayer::distortion_correction(unsigned char *src_buf, int src_w,
             // #circle radius
             dst.r = Pythagorean(dst.x, dst.y);
 
-            // #scale up // did in map
-            //r *= SCALE;
-
-            //#look up table
-            if(dst.r < low.first || dst.r > up.first) // optimization 1, by reducing queries
-            {
-#ifdef _BINARY_SEARCH_TREE_
-                distortion_tree.Search(dst.r, low.first, low.second, up.first, up.second);
-#else
-                if(itlasthit == itup) // optimization 2, forecast the next query (save 10 milliseconds)
-                {
-                    positive ? itlasthit++ : itlasthit--;
-                    itup = itlasthit;
-                    if(itup == rallymap.begin())
-                        itup++;
-                    itlow = itup;
-                    itlow--;
-
-                    low.first = itlow->first;
-                    low.second = itlow->second;
-                    up.first = itup->first;
-                    up.second = itup->second;
-                }
-
-                if(dst.r < low.first || dst.r > up.first)
-                {
-                    //[[ BEGIN to look up
-                    itup = rallymap.upper_bound(dst.r);  // return map::end if failed
-                    if(itup == rallymap.begin())
-                        itup++;
-                    itlow = itup;
-                    itlow--;
-
-                    low.first = itlow->first;
-                    low.second = itlow->second;
-                    up.first = itup->first;
-                    up.second = itup->second;
-                    //]] END
-
-                    positive = itup->first > itlasthit->first ? true : false;
-                    itlasthit = itup;
-                }
-#endif
-                //printf("info: %s mapping entry [%f, %f] - [%f, %f]\n", __FUNCTION__, low.first, low.second, up.first, up.second);
-
-            }
-
-            // #linear interpolation as approximation
-            //r2 = (itup->second*(r-itlow->first)+itlow->second*(itup->first-r))/(itup->first-itlow->first);
-            src.r = (up.second * (dst.r - low.first) + low.second * (up.first - dst.r)) / (up.first - low.first);
+            //#look up table, linear interpolation as approximation
+            src.r = map_radius(lut, dst.r, unit);
 
             // #calculating the slope
             slope = src.r / dst.r;
             src.x = dst.x * slope;
             src.y = dst.y * slope;
-            //if(i==0&&j==0) printf("slope=%f, r2=%f, x2=%f, y2=%f\n",  slope, r2, x2, y2);
 
-            /*
+            // symmetry points: [i, j], [h-i-1, j], [h-i-1, w-j-1], [i, w-j-1]
+            qx[0] = src.x;  qy[0] = src.y;  px[0] = j;               py[0] = i;
+            qx[1] = src.x;  qy[1] = -src.y; px[1] = j;               py[1] = dst.h - i - 1;
+            qx[2] = -src.x; qy[2] = -src.y; px[2] = dst.w - j - 1;   py[2] = dst.h - i - 1;
+            qx[3] = -src.x; qy[3] = src.y;  px[3] = dst.w - j - 1;   py[3] = i;
+
             // #coordinate translation
-            x2 += ox;
-            y2 += oy;
-            // #check range
-            x2 += 0.5;
-            x2 = min(x2, w);
-            x2 = max(0, x2);
-            y2 += 0.5;
-            y2 = min(y2, h);
-            y2 = max(0, y2);
-
-            // #storage 888 pixels
-            for(k = 0; k < 3; k++)
-                dst[pitch*i + 3*j + k] = src[pitch*(int)y2 + 3*(int)x2 + k];
-            */
-
-            // #bilinear interpolation
-            BilinearInterpolation(&dst.buf[dst.pitch*i+3*j], src);
-
-            // optimizationn 3, symmetry point
-            src.y *= (-1.0F);
-            BilinearInterpolation(&dst.buf[dst.pitch*(dst.h - i - 1)+3*j], src);
-
-            src.x *= (-1.0F);
-            BilinearInterpolation(&dst.buf[dst.pitch*(dst.h - i - 1)+3*(dst.w - j - 1)], src);
-
-            src.y *= (-1.0F);
-            BilinearInterpolation(&dst.buf[dst.pitch*i+3*(dst.w - j - 1)], src);
+            for(k = 0; k < 4; k++)
+                table->Set(px[k], py[k], qx[k] + src.ox, qy[k] + src.oy);
         }
     }
+}
+
+const RulerGrid *DistortionPlayer::DistortRuler(int width, int height, int xspacing, int yspacing)
+{
+    if(width < 2 || height < 2 || xspacing <= 0 || yspacing <= 0)
+        return NULL;
+
+    Autolock lock(&ruler_mtx);
+    size_t k;
+
+    for(k = 0; k < ruler_grids.size(); k++)
+    {
+        if(ruler_grids[k]->Match(width, height, xspacing, yspacing))
+            return ruler_grids[k];
+    }
+
+    unsigned long tick = GetTickCount();
+    RulerGrid *grid = new RulerGrid(width, height, xspacing, yspacing);
+    build_ruler_grid(grid);
+    ruler_grids.push_back(grid);
+    printf("info: build ruler %dx%d spacing %d,%d spans %u cost %u\n",
+            width, height, xspacing, yspacing, (unsigned int)grid->spans.size(), (unsigned int)(GetTickCount() - tick));
 
-    return;
+    return grid;
 }
 
-bool DistortionPlayer::NV12_to_RGB24(unsigned char* yuv,unsigned char* rgb,int width,int height)
+/*
+ * Same gather as DistortImageRGB over the straight grid, only the grid
+ * is known analytically, so every pixel is the weight of the lit pixels
+ * of its 2x2 source block and no image is warped
+ */
+void DistortionPlayer::build_ruler_grid(RulerGrid *grid)
 {
-    if (width < 1 || height < 1 || yuv == NULL || rgb == NULL)
-        return false;
-    const long len = width * height;
-    unsigned char* yData = yuv;
-    unsigned char* uData = &yData[len];
-    unsigned char* vData = &yData[len];
-    int i, j, k;
-    int buf[3];
-    int yIdx,uIdx,vIdx,idx;
-    for (i = 0;i < height;i++){
-        for (j = 0;j < width;j++){
-            yIdx = i * width + j;
-            uIdx = (i/2) * (width/2) + (j/2);
-            uIdx *= 2;
-            vIdx = uIdx+1;
-
-            buf[0] = (int)(yData[yIdx] + 1.370705 * (vData[uIdx] - 128));
-            buf[1] = (int)(yData[yIdx] - 0.698001 * (uData[uIdx] - 128) - 0.703125 * (vData[vIdx] - 128));
-            buf[2] = (int)(yData[yIdx] + 1.732446 * (uData[vIdx] - 128));
-
-            for (k = 0;k < 3;k++){
-                idx = (i * width + j) * 3 + k;
-                if(buf[k] >= 0 && buf[k] <= 255)
-                    rgb[idx] = buf[k];
-                else
-                    rgb[idx] = (buf[k] < 0)?0:255;
+    std::shared_ptr<const RemapTable> table = get_remap_table(grid->width, grid->height, grid->width, grid->height, FORWARD);
+    const unsigned int round = REMAP_WEIGHT_ONE / 2;
+    std::vector<unsigned char> row(grid->width);
+    int i, j, start;
+
+    for(i = 0; i < grid->height; i++)
+    {
+        const RemapEntry *entry = &table->entries[i * grid->width];
+
+        for(j = 0; j < grid->width; j++)
+        {
+            const RemapEntry &e = entry[j];
+            unsigned int w00 = REMAP_WEIGHT_ONE - e.w01 - e.w10 - e.w11;
+            unsigned int lit = 0;
+
+            if(grid->IsLine(e.x, e.y))
+                lit += w00;
+            if(grid->IsLine(e.x + 1, e.y))
+                lit += e.w01;
+            if(grid->IsLine(e.x, e.y + 1))
+                lit += e.w10;
+            if(grid->IsLine(e.x + 1, e.y + 1))
+                lit += e.w11;
+
+            row[j] = ((0xff * lit + round) >> REMAP_WEIGHT_BITS) & e.mask;
+        }
+
+        // runs above threshold
+        for(j = 0; j < grid->width; )
+        {
+            if(row[j] <= RULER_THRESHOLD)
+            {
+                j++;
+                continue;
             }
+            for(start = j; j < grid->width && row[j] > RULER_THRESHOLD; j++)
+                ;
+            grid->AddSpan(i, start, &row[start], j - start);
         }
     }
+}
+
+bool DistortionPlayer::NV12_to_RGB24(unsigned char* yuv,unsigned char* rgb,int width,int height)
+{
+    if (width < 1 || height < 1 || yuv == NULL || rgb == NULL)
+        return false;
+    nv12_to_rgb24(yuv, rgb, width, height); // SSE2/AVX2 picked by CPUID
     return true;
 }
 
@@ -945,13 +1420,46 @@ float DistortionPlayer::Pythagorean2(float x, float y)
     return 1.0F/Q_rsqrt(pow(x, 2) + pow(y, 2));
 }
 
+/*
+ * Radius through a lookup of the calibration, r in pixels of an image
+ * whose height gives unit (see LensModel::Unit), shared by the remap
+ * tables, the ruler lines and the overlay points
+ */
+float DistortionPlayer::map_radius(const RadialLookup &lut, float r, float unit)
+{
+    return lut.Map(r * unit) / unit;
+}
+
+/*
+ * CorrectPoint through a given calibration, so a polyline is not split
+ * between two of them by a reload
+ */
+bool DistortionPlayer::correct_point(const LensModel &model, float sx, float sy, int src_w, int src_h, int dst_w, int dst_h, MapPoint *pt)
+{
+    float x = sx - src_w / 2;
+    float y = sy - src_h / 2;
+    float r = Pythagorean(x, y);
+    float unit = model.Unit(src_h);
+    float slope = 1.0F;
+
+    // source radius to corrected radius, the inverse of the REVERSE table
+    if(r > 0.0F)
+        slope = map_radius(model.forward, r, unit) / r;
+
+    pt->x = x * slope + dst_w / 2;
+    pt->y = y * slope + dst_h / 2;
+
+    return pt->x >= 0.0F && pt->x <= (float)dst_w && pt->y >= 0.0F && pt->y <= (float)dst_h;
+}
+
 void DistortionPlayer::line_correction(unsigned char *buf, int pos, int pixelwidth, int color, int axis, int maptype)
 {
     int i, j;
     float slope;
-    std::map<float, float>::iterator itlow, itup;
-    std::map<float, float>& rallymap = (maptype == FORWARD) ? distortion_map : reverse_distortion_map;
-    struct MapEntry low, up;
+    std::shared_ptr<const LensModel> model = current_lens();
+    const RadialLookup &lut = model->Lookup(maptype);
+    // both directions have the camera image on one side
+    float unit = model->Unit(image_height);
 
     struct Pic src, dst;
     struct ArgbColor col(color);
@@ -969,9 +1477,6 @@ void DistortionPlayer::line_correction(unsigned char *buf, int pos, int pixelwid
     int k, offset, pt;
     int tmp;
 
-    memset(&low, 0, sizeof(low));
-    memset(&up, 0, sizeof(up));
-
     if(maptype == FORWARD) {
         src = Pic(NULL, image_width, image_height);
         dst = Pic(buf, screen_width, screen_height);
@@ -1009,21 +1514,7 @@ void DistortionPlayer::line_correction(unsigned char *buf, int pos, int pixelwid
 
                 //printf("-src...................... %f, %f\n", src.x, src.y);
 
-                if(src.r < low.first || src.r > up.first)
-                {
-                    itup = rallymap.upper_bound(src.r);
-                    if(itup == rallymap.begin())
-                        itup++;
-                    itlow = itup;
-                    itlow--;
-
-                    low.first = itlow->first;
-                    low.second = itlow->second;
-                    up.first = itup->first;
-                    up.second = itup->second;
-                }
-
-                dst.r = (up.second * (src.r - low.first) + low.second * (up.first - src.r)) / (up.first - low.first);
+                dst.r = map_radius(lut, src.r, unit);
                 slope = dst.r / src.r;
                 dst.x = src.x * slope + dst.ox;
                 dst.y = src.y * slope + dst.oy;
@@ -1136,6 +1627,8 @@ void DistortionPlayer::line_correction(unsigned char *buf, int pos, int pixelwid
 int main(int argc, char *argv[])
 {
     const int MAX_PATH = 260;
+    const int IMAGE_BUFSIZE = IMAGE_WIDTH * IMAGE_HEIGHT * 3;
+    const int SCREEN_BUFSIZE = SCREEN_WIDTH * SCREEN_HEIGHT * 3;
     const int NV12BUFSIZE = IMAGE_BUFSIZE/2;
 
     int i, bytes;
@@ -10,30 +10,102 @@
 #ifndef _DISTORTION_PLAYER_H_
 #define _DISTORTION_PLAYER_H_
 
-#include <map>
 #include <vector>
-#include "mycircleque.h"
+#include <atomic>
+#include <memory> // shared_ptr
+#include <limits.h> // PATH_MAX
+#include "spscque.h"
 #include "mythread.h"
-//#include "bst.h"
+#include "lenscalib.h"
+#include "radiallut.h"
+#include "remaptable.h"
+#include "remapcache.h"
+#include "rulergrid.h"
+#include "workerpool.h"
 #include "SDL2/SDL.h"
 
+// radius lookup backend, -D_RADIAL_MODEL_ picks the fitted model,
+// -D_BINARY_SEARCH_TREE_ the implicit search tree
+#if defined(_RADIAL_MODEL_)
+#include "radialmodel.h"
+typedef RadialModel RadialLookup;
+#define RADIAL_LOOKUP_NAME "model"
+#elif defined(_BINARY_SEARCH_TREE_)
+#include "bst.h"
+typedef BinarySearchTree RadialLookup;
+#define RADIAL_LOOKUP_NAME "tree"
+#else
+typedef RadialLut RadialLookup;
+#define RADIAL_LOOKUP_NAME "table"
+#endif
+
+// default geometry, 720p camera shown at 1080p
+#define IMAGE_WIDTH 1280
+#define IMAGE_HEIGHT 720
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+
 enum MapType
 {
     FORWARD,
     REVERSE
 };
 
+/*
+ * Radius lookups of one lens calibration, never changed once published,
+ * a frame keeps the one it started with
+ */
+struct LensModel
+{
+    unsigned int generation; // 0 for the built-in curve, +1 every reload
+    int height; // camera image height the radii are pixels of
+    uint64_t key; // hash of the samples and the lookup, names cached remap tables
+    RadialLookup forward; // FORWARD: source radius to corrected radius
+    RadialLookup reverse; // REVERSE: corrected radius to source radius
+
+    const RadialLookup &Lookup(int maptype) const
+    {
+        return (maptype == FORWARD) ? forward : reverse;
+    }
+
+    // lookup radius per pixel of a camera image camera_height high
+    float Unit(int camera_height) const
+    {
+        return (float)height / camera_height;
+    }
+};
+
+// called on the watcher thread after a reloaded calibration is in use
+typedef void (*CALIBRATION_CB)(void *ctx);
+
+/*
+ * A point of an overlay, in pixels of the image it belongs to
+ */
+struct MapPoint
+{
+    float x;
+    float y;
+};
+
 enum WorkMode
 {
     BLOCKING = 1,
     ASYNCHRO,
-    PLAYERWND
+    PLAYERWND // ASYNCHRO into a window of its own, SDL events of it are
+              // pumped by the application's main thread loop like any other
 };
 
 class DistortionPlayer
 {
 public:
-    DistortionPlayer(int workmode = BLOCKING);
+    /*
+     *  imagew/imageh: camera image, e.g. 1280x720, 1920x1080, 3840x2160
+     *  screenw/screenh: corrected image of the asynchronous pipeline
+     *  queues, window and lookups are sized from them
+     */
+    DistortionPlayer(int workmode = BLOCKING,
+                     int imagew = IMAGE_WIDTH, int imageh = IMAGE_HEIGHT,
+                     int screenw = SCREEN_WIDTH, int screenh = SCREEN_HEIGHT);
     virtual ~DistortionPlayer();
 
 public:
@@ -105,6 +177,75 @@ public:
     bool CorrectYLine(unsigned char *buf, int pos, int pixelwidth, int color);
     bool DistortYLine(unsigned char *buf, int pos, int pixelwidth, int color);
 
+    /*
+     * Geometry correction, the vector counterpart of CorrectImage
+     * for overlays which are just a few coordinates
+     *
+     *  sx, sy: point of the distorted source image (left-top is zero)
+     *  src_width/src_height: source image e.g. 1280x720
+     *  dst_width/dst_height: corrected image e.g. 1920x1080
+     *  pt: where CorrectImage puts that point
+     *
+     *  returns:  false if it lands outside of the corrected image
+     */
+    bool CorrectPoint(float sx, float sy, int src_width, int src_height, int dst_width, int dst_height, MapPoint *pt);
+
+    /*
+     * Correct a polyline, straight edges come out curved
+     *
+     *  pts: n source points, closed: also join the last one to the first
+     *  step: source pixels between two samples along an edge
+     *  out: corrected polyline, a closed one repeats its first point
+     *
+     *  returns:  number of points in out
+     */
+    int CorrectPolyline(const MapPoint *pts, int n, bool closed, float step,
+                        int src_width, int src_height, int dst_width, int dst_height,
+                        std::vector<MapPoint> &out);
+
+    /*
+     * Debug ruler, what DistortImageRGB makes of a straight grid
+     * built once per (size, spacing) from the FORWARD remap table
+     *
+     *  width/height: ruler layer e.g. 1280x720
+     *  xspacing/yspacing: pixels between two lines e.g. 112, 63
+     *
+     *  returns:  lit spans of the distorted grid, NULL on bad arguments
+     *            valid until the second calibration reload after it, a
+     *            holder drops it once GetCalibrationGeneration() moves
+     */
+    const RulerGrid *DistortRuler(int width, int height, int xspacing, int yspacing);
+
+    /*
+     * Lens calibration file, text or binary (see lenscalib.h), in place of
+     * the built-in samples
+     *  the remap tables in use are rebuilt first, then swapped in together
+     *  with the new curve, frames being corrected finish with the old ones
+     *
+     *  returns:  false if the file is not usable, the current calibration stays
+     */
+    bool LoadCalibration(const char *path);
+
+    /*
+     * Reload path from a background thread whenever it is written or
+     * renamed over, the file does not have to exist yet
+     *  cb: optional, called after every successful reload
+     */
+    bool WatchCalibration(const char *path, CALIBRATION_CB cb = NULL, void *ctx = NULL);
+
+    // bumped by every successful reload, e.g. to redraw cached overlays
+    unsigned int GetCalibrationGeneration();
+
+    /*
+     * Native camera image and corrected image of a BLOCKING player, e.g.
+     * a global one constructed before the command line is read
+     *  the lens lookups are rebuilt for the camera height, other
+     *  source sizes still work, scaled from it
+     *
+     *  returns:  false if it is not BLOCKING or a size is out of range
+     */
+    bool SetGeometry(int imagew, int imageh, int screenw, int screenh);
+
     /*
      * Push back a image into queue
      * asynchronous mode
@@ -117,6 +258,22 @@ public:
      */
     bool PushImage(unsigned char *buf);
 
+    /*
+     * Fused mode (default on)
+     *  CorrectImage and the asynchronous pipeline sample NV12 directly at
+     *  the remapped coordinates, without a full RGB24 intermediate image.
+     *  off: convert the whole frame to RGB24 first, then correct it
+     */
+    void SetFusedMode(bool on);
+
+    /*
+     * Threads sharing a correction, each one takes a horizontal band
+     *  n: 1 to run on the calling thread only (default: online cpus)
+     *  output does not depend on the number of threads
+     */
+    bool SetThreadCount(int n);
+    int GetThreadCount();
+
     /*
      * Control to start processing distortion correction
      */
@@ -141,36 +298,69 @@ protected:
 
     friend void *DistortionProcess(void *context);
     friend void *PlaybackVideo(void *context);
+    friend void *CalibrationWatch(void *context);
 
 private:
     void distortion_correction(unsigned char *src_buf, int src_w, int src_h, unsigned char *dst_buf, int dst_w, int dst_h, int maptype);
+    void distortion_correction_nv12(unsigned char *src_buf, int src_w, int src_h, unsigned char *dst_buf, int dst_w, int dst_h, int maptype);
     void line_correction(unsigned char *buf, int pos, int pixelwidth, int color, int axis, int maptype);
+    float map_radius(const RadialLookup &lut, float r, float unit);
+    bool correct_point(const LensModel &model, float sx, float sy, int src_w, int src_h, int dst_w, int dst_h, MapPoint *pt);
+    std::shared_ptr<const LensModel> current_lens();
+    std::shared_ptr<LensModel> build_lens(const LensCalibration &calib, int height);
+    bool apply_calibration(const LensCalibration &calib);
+    void stop_watching();
+    std::shared_ptr<const RemapTable> get_remap_table(int src_w, int src_h, int dst_w, int dst_h, int maptype);
+    RemapTable *make_remap_table(const LensModel &model, int src_w, int src_h, int dst_w, int dst_h, int maptype);
+    void build_remap_table(const LensModel &model, RemapTable *table);
+    void build_ruler_grid(RulerGrid *grid);
     
     float fast_sqrt(float x);
     float Q_rsqrt(float number);
     float Pythagorean2(float x, float y);
 
 private:
-    std::map<float, float> distortion_map;
-    std::map<float, float> reverse_distortion_map;
-    std::vector<unsigned char> rgbtmpbuf;
+    // current calibration, read with std::atomic_load, replaced under
+    // remap_mtx together with the tables built from it
+    std::shared_ptr<const LensModel> lens;
+    std::vector<unsigned char> rgbtmpbuf; // only used when not fused
+    std::vector<unsigned char> nv12_rows; // fused gather, a y and u,v row per band
+    MutexLock nv12_rows_mtx; // one fused frame at a time, they share nv12_rows
 
-#ifdef _BINARY_SEARCH_TREE_
-    BinarySearchTree distortion_tree;
-    BinarySearchTree reverse_distortion_tree;
-#endif
+    std::vector<std::shared_ptr<const RemapTable> > remap_tables; // of lens, per (src size, dst size, map type)
+    MutexLock remap_mtx; // protect remap_tables and the lens swap
+    // remap tables on disk, a later launch maps them instead of building them again,
+    // in $UVD_REMAP_CACHE ("" is off), else $HOME/.cache/uvdclient, fixed after construction
+    // as the watcher thread reads the directory without remap_mtx
+    RemapCache remap_cache;
+
+    std::vector<RulerGrid *> ruler_grids; // of lens, per (size, spacing)
+    std::vector<RulerGrid *> retired_rulers; // of the previous calibration, callers may still draw them
+    MutexLock ruler_mtx; // protect ruler_grids, taken before remap_mtx
+
+    MutexLock calibration_mtx; // one reload at a time
+    LensCalibration calibration; // samples in use
+    char calibration_path[PATH_MAX]; // watched file
+    const char *calibration_name; // its name in the watched directory
+    int calibration_fd; // inotify, -1 if not watching
+    CALIBRATION_CB calibration_cb;
+    void *calibration_ctx;
+
+    SpscCircleQue webcamque;  // input buffer fed by socket
+    SpscCircleQue distortionque; // output buffer of distorted image
 
-    MyCircleQue webcamque;  // input buffer fed by socket
-    MyCircleQue distortionque; // output buffer of distorted image
+    WorkerPool workers; // bands of distortion_correction
 
     MyThread distortion_thread;
     MyThread playback_thread;
+    MyThread calibration_thread; // runs while a file is watched
 
     SDL_Window *sdlwnd;
     SDL_Renderer *sdlrender;
     SDL_Texture *sdltexture;
 
     int mode;
+    std::atomic<bool> fused; // NV12 straight into the corrected RGB24, taken once per frame
 
     int image_width;  // source image
     int image_height;
@@ -178,7 +368,7 @@ private:
     int screen_height;
 
     int playback_time; // milliseconds to wait
-    int distortion_gap_time;
+    int queue_wait_time; // milliseconds to block on an empty queue
 };
 
 #endif
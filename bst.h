@@ -5,21 +5,22 @@
  *
  * Author: SONGYI (yi.song@polycom.com)
  * Date Created: 20180830
+ *
+ * Implicit binary search tree: nodes are kept in one array in Eytzinger
+ * (BFS) order, children of node i are 2i and 2i+1, so there is no node
+ * allocation and no child/parent pointer to chase. A search walks down
+ * with a branch free step and lands on the bracketing pair directly.
+ *
+ * Same interface as RadialLut (init, Map), build with -D_BINARY_SEARCH_TREE_
+ * to use it as the radius lookup backend of DistortionPlayer.
  */
 
-#ifndef _BINARY_SEARCH_TREE_
-#define _BINARY_SEARCH_TREE_
+#ifndef _BST_H_
+#define _BST_H_
 
 #include <stdio.h>
-#include <math.h>
-#include <iostream>
-
-#ifndef max
-#define max(a,b)	(((a) > (b)) ? (a) : (b))
-#endif
-
-#define EPSILON 1e-3
-#define EQUAL(a, b) (fabs((a)-(b)) < EPSILON)
+#include <vector>
+#include <algorithm>
 
 class BinarySearchTree
 {
@@ -27,339 +28,168 @@ public:
     struct tnode
     {
         float key;
-        float value;
-        struct tnode *left;
-        struct tnode *right;
-        struct tnode *parent;
+        int rank; // index of the key in sorted order
     };
 
-    typedef struct tnode *btree;
-
 public:
     BinarySearchTree()
     {
-        root = NULL;
     }
 
     virtual ~BinarySearchTree()
     {
-        destroy_tree(root);
     }
 
     void Insert(float key, float value)
     {
-        struct tnode *p = alloc_tree_node();
-        if(NULL != p)
-        {
-            p->key = key;
-            p->value = value;
-            insert_node(root, p);
-        }
-        else
-            printf("error: out of space! %s\n", __FUNCTION__);
+        size_t pos = std::upper_bound(keys.begin(), keys.end(), key) - keys.begin();
+        keys.insert(keys.begin() + pos, key);
+        values.insert(values.begin() + pos, value);
+        build();
     }
 
     void SmartInsert(float Key[], float Val[], int N)
     {
-        if(Key != NULL && Val != NULL && N > 0)
-        {
-            if(root == NULL)
-            {
-                int mid = N /2;
-                Insert(Key[mid], Val[mid]);
-                if(mid -1 >= 0)
-                    insert_middle(Key, Val, 0, mid-1); // [0, mid-1]
-                if(mid + 1 <= N -1)
-                    insert_middle(Key, Val, mid+1, N-1); // [mid+1, N-1]
-            }
-            else
-            {
-                insert_middle(Key, Val, 0, N-1);
-            }
-        }
-    }
-
-    void Search(float key, float &sin_key, float &sin_val, float &dex_key, float &dex_val)
-    {
-        struct tnode *node = search_node(root, key);
-        struct tnode *sibling;
-
-        if(node == NULL)
-        {
-            printf("fatal error: Ahhhhhhhhhhhhhhhh~\n");
+        if(Key == NULL || Val == NULL || N <= 0)
             return;
-        }
-
-        if(key < node->key)
-        {
-            sibling = predecessor(node);
-            if(sibling == NULL)
-                sibling = successor(node);
 
-            sin_key = sibling->key;
-            sin_val = sibling->value;
-            dex_key = node->key;
-            dex_val = node->value;
+        std::vector<std::pair<float, float> > pairs;
+        for(int i = 0; i < N; i++)
+            pairs.push_back(std::make_pair(Key[i], Val[i]));
+        for(size_t i = 0; i < keys.size(); i++)
+            pairs.push_back(std::make_pair(keys[i], values[i]));
+        std::stable_sort(pairs.begin(), pairs.end());
 
-        }
-        else
+        keys.resize(pairs.size());
+        values.resize(pairs.size());
+        for(size_t i = 0; i < pairs.size(); i++)
         {
-            sibling = successor(node);
-            if(sibling == NULL)
-                sibling = predecessor(node);
-
-            sin_key = node->key;
-            sin_val = node->value;
-            dex_key = sibling->key;
-            dex_val = sibling->value;
+            keys[i] = pairs[i].first;
+            values[i] = pairs[i].second;
         }
+        build();
     }
 
-    void Draw()
+    /*
+     * keys: ascending radii, values: mapped radii, n >= 2 points
+     */
+    bool init(const float *key, const float *value, int n)
     {
-        std::vector<std::vector<float> > layers;
-        const int DEPTH = Depth();
-        layers.resize(DEPTH, std::vector<float>());
-        preorder_walk(root, layers, 0);
-
-        int i, j, count=0;
-        for(i = 0; i < layers.size(); i++)
+        if(NULL == key || NULL == value || n < 2)
         {
-            std::cout << i+1 << "L:        ";
-            for(j = 0; j< layers[i].size(); j++)
-            {
-                std::cout << layers[i][j] << ", ";
-            }
-            std::cout << std::endl << std::endl;
-            count += j;
+            printf("error: search tree needs 2 points at least, n=%d\n", n);
+            return false;
         }
 
-        printf("Total leaf nodes: %d\n\n", count);
-    }
-
-    int Depth()
-    {
-        return cal_depth(root);
+        keys.assign(key, key + n);
+        values.assign(value, value + n);
+        build();
+        return true;
     }
 
-private:
-    struct tnode *alloc_tree_node()
+    /*
+     * Segment around key: sin_key <= key < dex_key, the first/last
+     * segment out of range
+     *  returns false if there are less than 2 nodes
+     */
+    bool Search(float key, float &sin_key, float &sin_val, float &dex_key, float &dex_val) const
     {
-        struct tnode *p = new struct tnode;
-        if(p == NULL)
-            printf("error: out of space in %s\n", __FUNCTION__);
-        memset(p, 0, sizeof(struct tnode));
-        return p;
-    }
+        const int n = keys.size();
+        if(n < 2)
+            return false;
 
-    void free_tree_node(struct tnode *&p)
-    {
-        if(p != NULL)
-        {
-            delete p;
-            p = NULL;
-        }
-    }
+        int k = upper_bound(key) - 1;
+        k = k < 0 ? 0 : (k > n - 2 ? n - 2 : k);
 
-    void destroy_tree(btree t)  // LRN Post-Order
-    {
-        if(t != NULL)
-        {
-            if(t->left != NULL) // to reduce recursion
-                destroy_tree(t->left);
-            if(t->right != NULL)
-                destroy_tree(t->right);
-            free_tree_node(t);
-        }
+        sin_key = keys[k];
+        sin_val = values[k];
+        dex_key = keys[k+1];
+        dex_val = values[k+1];
+        return true;
     }
 
-    void insert_node(btree &t, struct tnode *node)
+    /*
+     * Mapped value of key, piecewise linear
+     */
+    float Map(float key) const
     {
-        struct tnode *pos = NULL;
-        struct tnode *p = t;
-
-        while(p != NULL)
-        {
-            pos = p; // pos will be a leaf node when p traverse to NIL
-            if(node->key < p->key)
-                p = p->left;
-            else
-                p = p->right;
-        }
+        float k0 = 0.0F, v0 = 0.0F, k1 = 1.0F, v1 = 0.0F;
 
-        node->parent = pos;
-
-        if(pos == NULL) // empty tree
-        {
-            t = node;
-            printf("info: create binary search tree: %f, %f\n", node->key, node->value);
-        }
-        else
-        {
-            if(node->key < pos->key)
-                pos->left = node;
-            else
-                pos->right = node;
-        }
-    }
-
-    struct tnode *search_node(btree t, float x)
-    {
-#ifdef RECURSIVE_VERSION
-        if(t == NULL || is_the_closest(t, x))
-            return t;
-        if(x < t->key)
-            return search_node(t->left, x);
-        else
-            return search_node(t->right, x);
-#else // ITERATIVE_VERSION is faster
-        while(t != NULL && !(is_the_closest(t, x)))
-        {
-            if(x < t->key)
-                t = t->left;
-            else
-                t = t->right;
-        }
-        return t;
-#endif
+        Search(key, k0, v0, k1, v1);
+        return (v1 * (key - k0) + v0 * (k1 - key)) / (k1 - k0);
     }
 
-    struct tnode *successor(struct tnode *node)
+    bool IsEmpty() const
     {
-        if(node == NULL)
-            return node;
-
-        if(node->right != NULL)
-            return minimum(node->right);
-
-        // case 2: has no right subtree
-        // to search a parent that bigger (its left child is previous parent)
-        struct tnode *p = node->parent;
-        while(p != NULL && p->right == node)
-        {
-            node = p;
-            p = p->parent;
-        }
-        return p;
+        return keys.empty();
     }
 
-    struct tnode *predecessor(struct tnode *node)
+    void Draw()
     {
-        if(node == NULL)
-            return node;
-
-        if(node->left != NULL)
-            return maximum(node->left);
+        int level = 1;
 
-        struct tnode *p = node->parent;
-        while(p != NULL && p->left == node)
+        for(size_t first = 1; first < nodes.size(); first *= 2, level++)
         {
-            node = p;
-            p = p->parent;
+            printf("%dL:        ", level);
+            for(size_t i = first; i < first * 2 && i < nodes.size(); i++)
+                printf("%g, ", nodes[i].key);
+            printf("\n\n");
         }
-        return p;
-    }
-
-    struct tnode *minimum(btree t)
-    {
-        if(t == NULL)
-            return t;
-        while(t->left != NULL)
-            t = t->left;
-        return t;
-    }
 
-    struct tnode *maximum(btree t)
-    {
-        if(t == NULL)
-            return t;
-        while(t->right != NULL)
-            t = t->right;
-        return t;
+        printf("Total leaf nodes: %d\n\n", (int)keys.size());
     }
 
-    int cal_depth(btree t)
+    int Depth()
     {
-        int depth = 0, h1 = 0, h2 = 0;
+        int depth = 0;
 
-        if(t == NULL)
-            return depth;
-
-        h1 = cal_depth(t->left);
-        h2 = cal_depth(t->right);
-        depth = max(h1, h2) + 1;
+        for(size_t n = keys.size(); n > 0; n /= 2)
+            depth++;
         return depth;
     }
 
-    bool is_the_closest(struct tnode *t, float x)
+private:
+    /*
+     * Sorted rank of the first key > x, number of keys if none
+     */
+    int upper_bound(float x) const
     {
-        // there are bugs in this function
-        // but writing bst class is aim to prove whether std::map is a tree
-        // as a result std::map is truely a tree and about 6,7 milliseconds faster
-        float current_diff = fabs(t->key - x);
-        float nextdiff = 0.0F;
+        const int n = keys.size();
+        const tnode *t = &nodes[0];
+        int i = 1;
 
-        if(x < t->key)
-        {
-            if(t->left != NULL)
-                nextdiff = fabs(t->left->key - x);
-            else
-                return true;
-        }
-        else
-        {
-            if(t->right != NULL)
-                nextdiff = fabs(t->right->key - x);
-            else
-                return true;
-        }
+        // right when key <= x, the compare is an add, not a branch
+        while(i <= n)
+            i = 2 * i + (t[i].key <= x);
 
-        if(current_diff < nextdiff)
-            return true;
-        else
-            return false;
+        // undo the right turns after the last left one
+        i >>= __builtin_ffs(~i);
+        return i == 0 ? n : t[i].rank;
     }
 
-    void preorder_walk(btree t, std::vector<std::vector<float> >& layers, int i)
+    // lay the sorted keys out in BFS order, in-order walk of the implicit tree
+    int fill(int i, int k)
     {
-        if(t != NULL)
+        if(i < (int)nodes.size())
         {
-            layers[i].push_back(t->key);
-            preorder_walk(t->left, layers, i+1);
-            preorder_walk(t->right, layers, i+1);
+            k = fill(2 * i, k);
+            nodes[i].key = keys[k];
+            nodes[i].rank = k;
+            k = fill(2 * i + 1, k + 1);
         }
+        return k;
     }
 
-    void insert_middle(float Key[], float Val[], int i, int j)
+    void build()
     {
-        if(i > j)
-        {
-            printf("error: impossible!%s\n", __FUNCTION__);
-            return;
-        }
-
-        if(i == j)
-        {
-            Insert(Key[i], Val[i]);
-        }
-        else if(i + 1 == j)
-        {
-            Insert(Key[i], Val[i]);
-            Insert(Key[j], Val[j]);
-        }
-        else
-        {
-            int mid = (i + j) / 2;
-            Insert(Key[mid], Val[mid]);
-            if(mid - 1 >= i)
-                insert_middle(Key, Val, i, mid-1);
-            if(mid + 1 <= j)
-                insert_middle(Key, Val, mid+1, j);
-        }
+        nodes.resize(keys.size() + 1); // node 0 is not used
+        fill(1, 0);
     }
 
 private:
-    struct tnode *root;
+    std::vector<float> keys; // sorted
+    std::vector<float> values;
+    std::vector<tnode> nodes; // Eytzinger order, 1 based
 };
 
 #endif
@@ -26,12 +26,22 @@
 using namespace std;
 using namespace cv;
 
-#define PIXEL_W 1280
-#define PIXEL_H 720
+// frame geometry unless the command line says otherwise
+#define DEFAULT_PIXEL_W 1280
+#define DEFAULT_PIXEL_H 720
+#define DEFAULT_CORRECTED_W 1920 // CorrectImageRGB output
+#define DEFAULT_CORRECTED_H 1080
+#define FRAME_MAX_SIZE 8192 // width or height
+#define WINDOW_MAX_W 1920 // bigger frames are scaled down into the window
+#define WINDOW_MAX_H 1080
 #define VIDEO_FRAME_BUFFER_NUMBER 5
-#define VIDEO_FRAME_SIZE_NV12 1382400	// 1280 * 720 * 1.5
-#define VIDEO_FRAME_SIZE_RGB 2764800	// 1280 * 720 * 3
-#define VIDEO_FRAME_SIZE_RGBA 3686400	// 1280 * 720 * 4
+#define VIDEO_STATS_INTERVAL 250 // framed video, log drops and latency every 10 s at 25 fps
+#define VIDEO_DECODER_MAX 4 // JPEG decoder threads, at most one per core
+#define OVERLAY_SLOT_NUMBER 3 // per overlay layer: latest, shown, being drawn
+#define SYNC_MAX_FRAMES 8 // video frames held for their metadata, -s
+#define SYNC_BUDGET_MAX 1000 // ms
+#define SYNC_JITTER_ENTRIES 32 // metadata messages kept per stream
+#define SYNC_TICK_MS 5 // held frames are checked against the budget this often
 
 #define VIDEO_PORT 5881
 #define FACE_PORT 5882
@@ -40,11 +50,127 @@ using namespace cv;
 
 #define MAX_FACE 256
 
+// ruler grid spacing, 16:9 steps, 112x63 pixels by default
+#define RULER_STEP_X 16
+#define RULER_STEP_Y 9
+#define RULER_SCALE 7
+#define RULER_SCALE_MIN 2
+#define RULER_SCALE_MAX 20
+
 #define REFRESH_EVENT (SDL_USEREVENT + 1)
 
+// layers of the debug windows, bit k of a dirty mask is layer k
+#define LAYER_VIDEO_INDEX 0
+#define LAYER_RULER_INDEX 1
+#define LAYER_FACE_INDEX 2
+#define LAYER_AUDIO_INDEX 3
+#define LAYER_CROP_INDEX 4
+#define LAYER_COUNT 5
+
+#define LAYER_VIDEO (1 << LAYER_VIDEO_INDEX)
+#define LAYER_RULER (1 << LAYER_RULER_INDEX)
+#define LAYER_FACE (1 << LAYER_FACE_INDEX)
+#define LAYER_AUDIO (1 << LAYER_AUDIO_INDEX)
+#define LAYER_CROP (1 << LAYER_CROP_INDEX)
+#define LAYER_ALL ((1 << LAYER_COUNT) - 1)
+
+// sizes every buffer, texture and remap table is made of, fixed at start
+typedef struct FrameGeometry {
+	int width; // source frame, NV12 from the server
+	int height;
+	int correctedWidth; // corrected frame of the distortion window
+	int correctedHeight;
+
+	int sizeNV12() const { return width * height * 3 / 2; }
+	int sizeRGB() const { return width * height * 3; }
+	int sizeRGBA() const { return width * height * 4; }
+}_FrameGeometry;
+
+// "WxH", both even and within FRAME_MAX_SIZE (NV12 is subsampled by 2)
+inline bool parseFrameSize(const char *text, int *width, int *height)
+{
+	int w, h;
+	char tail;
+
+	if (text == NULL || sscanf(text, "%dx%d%c", &w, &h, &tail) != 2)
+		return false;
+	if (w < 2 || h < 2 || w > FRAME_MAX_SIZE || h > FRAME_MAX_SIZE || (w & 1) || (h & 1))
+		return false;
+	*width = w;
+	*height = h;
+	return true;
+}
+
+// window of a width x height frame, scaled down to fit WINDOW_MAX_W x WINDOW_MAX_H
+inline SDL_Rect fitWindowRect(int width, int height)
+{
+	SDL_Rect rect = {0, 0, width, height};
+
+	if (rect.w > WINDOW_MAX_W || rect.h > WINDOW_MAX_H)
+	{
+		if ((long long)width * WINDOW_MAX_H > (long long)height * WINDOW_MAX_W)
+		{
+			rect.w = WINDOW_MAX_W;
+			rect.h = (int)((long long)height * WINDOW_MAX_W / width);
+		}
+		else
+		{
+			rect.w = (int)((long long)width * WINDOW_MAX_H / height);
+			rect.h = WINDOW_MAX_H;
+		}
+	}
+	return rect;
+}
+
 typedef struct FaceFrame {
 	int faceNumber;
 	int facePosition[MAX_FACE][4];
 }_FaceFrame;
 
+// overlay geometry in source image coordinates, drawn as vectors by distortionWindow
+typedef struct OverlayShapes {
+	FaceFrame faceFrame;
+	int audioPosition;
+	int cropPosition[4];
+}_OverlayShapes;
+
+#define FACE_LABEL_SCALE 0.5
+#define FACE_LABEL_THICKNESS 2
+
+// "(x,y,w,h)" label put above a face box
+inline string faceLabelText(const int *facePosition)
+{
+	string strInfo  = "(";
+	strInfo += std::to_string(facePosition[0]);
+	strInfo += ",";
+	strInfo += std::to_string(facePosition[1]);
+	strInfo += ",";
+	strInfo += std::to_string(facePosition[2] - facePosition[0]);
+	strInfo += ",";
+	strInfo += std::to_string(facePosition[3] - facePosition[1]);
+	strInfo += ")";
+	return strInfo;
+}
+
+// baseline origin of the label
+inline Point faceLabelOrigin(const int *facePosition)
+{
+	return Point(facePosition[0], facePosition[1] - 10);
+}
+
+// area the label covers: box from the origin at its baseline, plus the stroke
+inline SDL_Rect faceLabelRect(const int *facePosition, const string &text)
+{
+	int baseline = 0;
+	Size textSize = getTextSize(text, FONT_HERSHEY_SIMPLEX, FACE_LABEL_SCALE, FACE_LABEL_THICKNESS, &baseline);
+	Point origin = faceLabelOrigin(facePosition);
+	SDL_Rect rect;
+
+	rect.x = origin.x - FACE_LABEL_THICKNESS;
+	rect.y = origin.y - textSize.height - FACE_LABEL_THICKNESS;
+	rect.w = textSize.width + FACE_LABEL_THICKNESS * 2;
+	rect.h = textSize.height + baseline + FACE_LABEL_THICKNESS * 2;
+	return rect;
+}
+
 #endif
\ No newline at end of file
@@ -2,22 +2,31 @@
 #include "common.h"
 #include "distortionWindow.h"
 
-extern "C" pthread_mutex_t gMutex;
+#define OVERLAY_STEP 16.0F // source pixels between two corrected samples of an edge
+
 extern "C" DistortionPlayer gDistortionPlayer;
 
-int distortionWindow::init(int width, int height)
+int distortionWindow::init(int width, int height, int correctedWidth, int correctedHeight)
 {
-    this->win_width = width;
-    this->win_height = height;
+    this->frame_width = width;
+    this->frame_height = height;
+    this->corrected_width = correctedWidth;
+    this->corrected_height = correctedHeight;
+    this->distortionValid = false;
 
-    this->sdlRect.x = 0;
-    this->sdlRect.y = 0;
-    this->sdlRect.w = this->win_width;
-    this->sdlRect.h = this->win_height;
+    // the window shows the corrected frame, as big as the source one fits
+    this->sdlRect = fitWindowRect(width, height);
+    this->win_width = this->sdlRect.w;
+    this->win_height = this->sdlRect.h;
 
-    this->pDeRenderFrameBufferARGB = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGBA);
-    this->pDeRenderFrameBufferRGB = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGB);
-    this->pDistortionFrameBuffer = (unsigned char *)malloc(1920 * 1080 * 3);
+    this->pCompositeFrameBufferBGR = (unsigned char *)malloc(width * height * 3);
+    this->pDistortionFrameBuffer = (unsigned char *)malloc(correctedWidth * correctedHeight * 3);
+    this->pLabelPositions = (int *)malloc(MAX_FACE * 4 * sizeof(int));
+    if (this->pCompositeFrameBufferBGR == NULL || this->pDistortionFrameBuffer == NULL || this->pLabelPositions == NULL)
+    {
+        SDL_Log("malloc distortion frame buffer error.");
+        return -1;
+    }
 
     this->sdlWindow = SDL_CreateWindow(
         "Utopia Debug Window - Distortion Window",
@@ -42,82 +51,39 @@ int distortionWindow::init(int width, int height)
         return -1;
     }
 
-    this->videoTexture = SDL_CreateTexture(
-        this->sdlRender,
-        SDL_PIXELFORMAT_NV12,
-        SDL_TEXTUREACCESS_STREAMING,
-        this->win_width,
-        this->win_height);
-    if (this->videoTexture == NULL)
-    {
-        SDL_Log("create video texture failed, error info: %s", SDL_GetError());
-        return -1;
-    }
-
-    this->rulerTexture = SDL_CreateTexture(
-        this->sdlRender,
-        SDL_PIXELFORMAT_RGBA8888,
-        SDL_TEXTUREACCESS_STREAMING,
-        this->win_width,
-        this->win_height);
-    if (this->rulerTexture == NULL)
-    {
-        SDL_Log("create ruler texture failed, error info: %s", SDL_GetError());
-        return -1;
-    }
-    SDL_SetTextureBlendMode(this->rulerTexture, SDL_BLENDMODE_BLEND);
-
-
-	this->faceTexture = SDL_CreateTexture(
+	this->distortionTexture = SDL_CreateTexture(
 		this->sdlRender,
-		SDL_PIXELFORMAT_RGBA8888,
+		SDL_PIXELFORMAT_BGR24,              // channel order of DistortionPlayer
 		SDL_TEXTUREACCESS_STREAMING,
-		this->win_width,
-		this->win_height);
-	if (this->faceTexture == NULL)
+        this->corrected_width,
+		this->corrected_height);
+	if (this->distortionTexture == NULL)
 	{
-		SDL_Log("create face texture failed, error info: %s", SDL_GetError());
+		SDL_Log("create ditortion texture failed, error info: %s", SDL_GetError());
 		return -1;
-	}
-    SDL_SetTextureBlendMode(this->faceTexture, SDL_BLENDMODE_BLEND);
+    }
 
-	this->audioTexture = SDL_CreateTexture(
-		this->sdlRender,
-		SDL_PIXELFORMAT_RGBA8888,
-		SDL_TEXTUREACCESS_STREAMING,
-		this->win_width,
-		this->win_height);
-	if (this->audioTexture == NULL)
-	{
-		SDL_Log("create audio texture failed, error info: %s", SDL_GetError());
-		return -1;
-	}
-    SDL_SetTextureBlendMode(this->audioTexture, SDL_BLENDMODE_BLEND);
+    // a cell per face, the longest label text of a box inside the frame fits it
+    int widest[4] = {this->frame_width, this->frame_height, -this->frame_width, -this->frame_height};
+    SDL_Rect cell = faceLabelRect(widest, faceLabelText(widest));
+    this->labelCellWidth = min(cell.w, this->frame_width);
+    this->labelCellHeight = cell.h;
+    this->labelCellsPerRow = this->frame_width / this->labelCellWidth;
+    this->labelNumber = -1;
 
-	this->cropTexture = SDL_CreateTexture(
+	this->labelTexture = SDL_CreateTexture(
 		this->sdlRender,
 		SDL_PIXELFORMAT_RGBA8888,
 		SDL_TEXTUREACCESS_STREAMING,
-		this->win_width,
-		this->win_height);
-	if (this->cropTexture == NULL)
+		this->frame_width,
+		(MAX_FACE + this->labelCellsPerRow - 1) / this->labelCellsPerRow * this->labelCellHeight);
+	if (this->labelTexture == NULL)
 	{
-		SDL_Log("create crop texture failed, error info: %s", SDL_GetError());
+		SDL_Log("create label texture failed, error info: %s", SDL_GetError());
 		return -1;
 	}
-    SDL_SetTextureBlendMode(this->cropTexture, SDL_BLENDMODE_BLEND);
-
-	this->distortionTexture = SDL_CreateTexture(
-		this->sdlRender,
-		SDL_PIXELFORMAT_RGB24,
-		SDL_TEXTUREACCESS_STREAMING,
-        1920,
-		1080);
-	if (this->distortionTexture == NULL)
-	{
-		SDL_Log("create ditortion texture failed, error info: %s", SDL_GetError());
-		return -1;
-    }
+    SDL_SetTextureBlendMode(this->labelTexture, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawBlendMode(this->sdlRender, SDL_BLENDMODE_BLEND);
 
     SDL_RenderClear(this->sdlRender);
 
@@ -126,6 +92,9 @@ int distortionWindow::init(int width, int height)
 
 int distortionWindow::handleEvent(
     SDL_Event event,
+    unsigned int dirtyLayers,
+    const SDL_Rect *dirtyRects,
+    const OverlayShapes *pShapes,
     void *pVideoFrameBuffer,
     void *pRulerFrameBufferRGBA,
     void *pFaceFrameBuffer,
@@ -150,6 +119,9 @@ int distortionWindow::handleEvent(
     {
         SDL_Log("REFRESH_EVENT");
         this->refreshWindow(
+            dirtyLayers,
+            dirtyRects,
+            pShapes,
             pVideoFrameBuffer,
             pRulerFrameBufferRGBA,
             pFaceFrameBuffer,
@@ -166,6 +138,9 @@ int distortionWindow::handleEvent(
 }
 
 int distortionWindow::refreshWindow(
+    unsigned int dirtyLayers,
+    const SDL_Rect *dirtyRects,
+    const OverlayShapes *pShapes,
     void *pVideoFrameBuffer,
     void *pRulerFrameBufferRGBA,
     void *pFaceFrameBuffer,
@@ -173,56 +148,287 @@ int distortionWindow::refreshWindow(
     void *pCropFrameBuffer
     )
 {
-    SDL_RenderClear(this->sdlRender);
-
-    pthread_mutex_lock(&gMutex);
-    SDL_UpdateTexture(this->videoTexture, NULL, pVideoFrameBuffer, this->win_width);
-    pthread_mutex_unlock(&gMutex);
-    SDL_RenderCopy(this->sdlRender, this->videoTexture, NULL, &this->sdlRect);
-
-    // update ruler
-    SDL_UpdateTexture(this->rulerTexture, NULL, pRulerFrameBufferRGBA, this->win_width * 4);
-    SDL_RenderCopy(this->sdlRender, this->rulerTexture, NULL, &this->sdlRect);
-
-    // update face
-    SDL_UpdateTexture(this->faceTexture, NULL, pFaceFrameBuffer, this->win_width * 4);
-    SDL_RenderCopy(this->sdlRender, this->faceTexture, NULL, &this->sdlRect);
-
-    // update audio
-    SDL_UpdateTexture(this->audioTexture, NULL, pAudioFrameBuffer, this->win_width * 4);
-    SDL_RenderCopy(this->sdlRender, this->audioTexture, NULL, &this->sdlRect);
+    int pixels = this->frame_width * this->frame_height;
 
-    // update crop
-	SDL_UpdateTexture(this->cropTexture, NULL, pCropFrameBuffer, this->win_width * 4);
-    SDL_RenderCopy(this->sdlRender, this->cropTexture, NULL, &this->sdlRect);
+    // compose video and ruler in source space on the CPU, nothing is read back from the GPU,
+    // an overlay only refresh keeps the corrected frame already in the texture
+    if ((dirtyLayers & (LAYER_VIDEO | LAYER_RULER)) || !this->distortionValid)
+    {
+        gDistortionPlayer.NV12_to_RGB24((unsigned char *)pVideoFrameBuffer, this->pCompositeFrameBufferBGR, this->frame_width, this->frame_height);
+        this->blendLayer((unsigned char *)pRulerFrameBufferRGBA, this->pCompositeFrameBufferBGR, pixels);
 
-    //
-    SDL_RenderReadPixels(this->sdlRender, &this->sdlRect, SDL_PIXELFORMAT_ARGB8888, this->pDeRenderFrameBufferARGB, this->win_width * 4);
-    this->convertARGBtoRGB(this->pDeRenderFrameBufferARGB, this->pDeRenderFrameBufferRGB, this->win_width, this->win_height);
-    gDistortionPlayer.CorrectImageRGB(this->pDeRenderFrameBufferRGB, this->win_width, this->win_height, this->pDistortionFrameBuffer, 1920, 1080);
-    SDL_UpdateTexture(this->distortionTexture, NULL, this->pDistortionFrameBuffer, 1920 * 3);
+        gDistortionPlayer.CorrectImageRGB(this->pCompositeFrameBufferBGR, this->frame_width, this->frame_height, this->pDistortionFrameBuffer, this->corrected_width, this->corrected_height);
+        SDL_UpdateTexture(this->distortionTexture, NULL, this->pDistortionFrameBuffer, this->corrected_width * 3);
+        this->distortionValid = true;
+    }
 
     SDL_RenderClear(this->sdlRender);
     SDL_RenderCopy(this->sdlRender, this->distortionTexture, NULL, &this->sdlRect);
 
+    // face, audio and crop are a few shapes, corrected as geometry on top
+    this->drawOverlays(pShapes);
+
     // show
     SDL_RenderPresent(this->sdlRender);
 
     return 0;
 }
 
-int distortionWindow::convertARGBtoRGB(
-    unsigned char *pArgb,
-    unsigned char *pRgb,
-    int w,
-    int h
+/*
+ * Blend a RGBA8888 layer over a BGR24 frame, the same as SDL_BLENDMODE_BLEND
+ * layer bytes are A, B, G, R in memory (RGBA8888 on little endian)
+ */
+int distortionWindow::blendLayer(
+    const unsigned char *pRgba,
+    unsigned char *pBgr,
+    int pixels
     )
 {
-    for (int i=0; i< w*h; i++)
+    for (int i=0; i<pixels; i++)
+    {
+        unsigned int a = pRgba[4*i];
+        if (a == 0)
+        {
+            continue; // overlays are mostly transparent
+        }
+
+        if (a == 0xff)
+        {
+            pBgr[3*i] = pRgba[4*i + 1];
+            pBgr[3*i + 1] = pRgba[4*i + 2];
+            pBgr[3*i + 2] = pRgba[4*i + 3];
+            continue;
+        }
+
+        // (src * a + dst * (255 - a)) / 255, rounded
+        for (int c=0; c<3; c++)
+        {
+            unsigned int v = pRgba[4*i + 1 + c] * a + pBgr[3*i + c] * (255 - a) + 128;
+            pBgr[3*i + c] = (unsigned char)((v + (v >> 8)) >> 8);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Draw face, audio and crop in the same order and colors as their layers
+ */
+int distortionWindow::drawOverlays(const OverlayShapes *pShapes)
+{
+    const int *pos;
+    MapPoint a, b;
+    int x0, y0, x1, y1;
+    SDL_Rect frame = {0, 0, this->frame_width, this->frame_height};
+
+    if (pShapes == NULL)
+    {
+        return -1;
+    }
+
+    this->drawLabels(pShapes);
+
+    // face: translucent box, 2 pixels border, label above it
+    for (int i = 0; i < pShapes->faceFrame.faceNumber; i++)
+    {
+        pos = pShapes->faceFrame.facePosition[i];
+
+        SDL_SetRenderDrawColor(this->sdlRender, 0x00, 0xff, 0x00, 0x44);
+        this->fillRect(pos[0], pos[1], pos[2], pos[3]);
+        SDL_SetRenderDrawColor(this->sdlRender, 0x00, 0xff, 0x00, 0xff);
+        this->drawRectOutline(pos[0], pos[1], pos[2], pos[3], 2);
+
+        // text is not warped, only placed: its cell of labelTexture, see drawLabels
+        SDL_Rect label = faceLabelRect(pos, faceLabelText(pos));
+        SDL_Rect clip;
+        if (!SDL_IntersectRect(&label, &frame, &clip))
+        {
+            continue;
+        }
+        SDL_Rect cell = this->labelCell(i);
+        clip.w = cell.w = min(clip.w, cell.w);
+        clip.h = cell.h = min(clip.h, cell.h);
+
+        gDistortionPlayer.CorrectPoint(clip.x, clip.y, this->frame_width, this->frame_height, this->corrected_width, this->corrected_height, &a);
+        gDistortionPlayer.CorrectPoint(clip.x + clip.w, clip.y + clip.h, this->frame_width, this->frame_height, this->corrected_width, this->corrected_height, &b);
+        this->toWindow(&a, &x0, &y0);
+        this->toWindow(&b, &x1, &y1);
+        SDL_Rect target = {x0, y0, x1 - x0, y1 - y0};
+        SDL_RenderCopy(this->sdlRender, this->labelTexture, &cell, &target);
+    }
+
+    // audio: 4 pixels wide vertical line
+    if (pShapes->audioPosition >= 3 && pShapes->audioPosition <= this->frame_width)
+    {
+        SDL_SetRenderDrawColor(this->sdlRender, 0x00, 0xff, 0xff, 0x7f);
+        this->fillRect(pShapes->audioPosition - 2, 0, pShapes->audioPosition + 2, this->frame_height);
+    }
+
+    // crop: 4 pixels border
+    if (pShapes->cropPosition[3] != 0)
+    {
+        pos = pShapes->cropPosition;
+        SDL_SetRenderDrawColor(this->sdlRender, 0x00, 0x00, 0xff, 0xff);
+        this->drawRectOutline(pos[0], pos[1], pos[2], pos[3], 4);
+    }
+
+    return 0;
+}
+
+/*
+ * Labels of the faces, face i in cell i of labelTexture so overlapping
+ * labels keep their own pixels, drawn again only when the faces change
+ *  returns:  true if the cells were drawn
+ */
+bool distortionWindow::drawLabels(const OverlayShapes *pShapes)
+{
+    const FaceFrame &faces = pShapes->faceFrame;
+    SDL_Rect frame = {0, 0, this->frame_width, this->frame_height};
+    Mat cell(this->labelCellHeight, this->labelCellWidth, CV_8UC4);
+
+    if (faces.faceNumber == this->labelNumber &&
+        memcmp(faces.facePosition, this->pLabelPositions, faces.faceNumber * sizeof(faces.facePosition[0])) == 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < faces.faceNumber; i++)
     {
-        pRgb[3*i] = pArgb[4*i+2];
-        pRgb[3*i + 1] = pArgb[4*i+1];
-        pRgb[3*i + 2] = pArgb[4*i];
+        const int *pos = faces.facePosition[i];
+        string text = faceLabelText(pos);
+        SDL_Rect label = faceLabelRect(pos, text);
+        SDL_Rect clip;
+        if (!SDL_IntersectRect(&label, &frame, &clip))
+        {
+            continue;
+        }
+
+        // the visible part of the label from the cell's left top
+        SDL_Rect target = this->labelCell(i);
+        Point origin = faceLabelOrigin(pos);
+        cell = Scalar::all(0);
+        putText(cell, text, Point(origin.x - clip.x, origin.y - clip.y), FONT_HERSHEY_SIMPLEX, FACE_LABEL_SCALE, cvScalar(255, 0, 255, 0), FACE_LABEL_THICKNESS, 4);
+        SDL_UpdateTexture(this->labelTexture, &target, cell.data, this->labelCellWidth * 4);
     }
+
+    this->labelNumber = faces.faceNumber;
+    memcpy(this->pLabelPositions, faces.facePosition, faces.faceNumber * sizeof(faces.facePosition[0]));
+    return true;
+}
+
+SDL_Rect distortionWindow::labelCell(int index)
+{
+    SDL_Rect cell = {
+        index % this->labelCellsPerRow * this->labelCellWidth,
+        index / this->labelCellsPerRow * this->labelCellHeight,
+        this->labelCellWidth,
+        this->labelCellHeight};
+    return cell;
+}
+
+/*
+ * Outline of source pixels [left, right) x [top, bottom), border pixels thick
+ */
+int distortionWindow::drawRectOutline(int left, int top, int right, int bottom, int border)
+{
+    std::vector<MapPoint> out;
+
+    for (int k = 0; k < border; k++)
+    {
+        MapPoint rect[4] = {
+            {(float)(left + k), (float)(top + k)},
+            {(float)(right - 1 - k), (float)(top + k)},
+            {(float)(right - 1 - k), (float)(bottom - 1 - k)},
+            {(float)(left + k), (float)(bottom - 1 - k)}
+        };
+        int n = gDistortionPlayer.CorrectPolyline(rect, 4, true, OVERLAY_STEP,
+            this->frame_width, this->frame_height, this->corrected_width, this->corrected_height, out);
+        this->drawPolyline(&out[0], n);
+    }
+
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Fill source pixels [left, right) x [top, bottom)
+ */
+int distortionWindow::fillRect(int left, int top, int right, int bottom)
+{
+    std::vector<MapPoint> out;
+    MapPoint rect[4] = {
+        {(float)left, (float)top},
+        {(float)right, (float)top},
+        {(float)right, (float)bottom},
+        {(float)left, (float)bottom}
+    };
+
+    int n = gDistortionPlayer.CorrectPolyline(rect, 4, true, OVERLAY_STEP,
+        this->frame_width, this->frame_height, this->corrected_width, this->corrected_height, out);
+    return this->fillPolygon(&out[0], n);
+}
+
+int distortionWindow::drawPolyline(const MapPoint *pts, int n)
+{
+    std::vector<SDL_Point> points(n);
+
+    for (int i = 0; i < n; i++)
+    {
+        this->toWindow(&pts[i], &points[i].x, &points[i].y);
+    }
+    return SDL_RenderDrawLines(this->sdlRender, &points[0], n);
+}
+
+/*
+ * Scanline fill, one span per window row between the outermost crossings,
+ * the corrected rectangles are close enough to convex for that
+ */
+int distortionWindow::fillPolygon(const MapPoint *pts, int n)
+{
+    std::vector<SDL_Point> points(n);
+    std::vector<SDL_Rect> spans;
+    int top = this->win_height, bottom = -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        this->toWindow(&pts[i], &points[i].x, &points[i].y);
+        top = min(top, points[i].y);
+        bottom = max(bottom, points[i].y);
+    }
+    top = max(top, 0);
+    bottom = min(bottom, this->win_height - 1);
+
+    for (int y = top; y <= bottom; y++)
+    {
+        int left = this->win_width, right = -1;
+        for (int i = 0; i < n; i++)
+        {
+            const SDL_Point &p = points[i];
+            const SDL_Point &q = points[(i + 1) % n];
+            if ((p.y <= y && q.y >= y) || (q.y <= y && p.y >= y))
+            {
+                int x = (p.y == q.y) ? p.x : p.x + (q.x - p.x) * (y - p.y) / (q.y - p.y);
+                left = min(left, (p.y == q.y) ? min(p.x, q.x) : x);
+                right = max(right, (p.y == q.y) ? max(p.x, q.x) : x);
+            }
+        }
+        if (left <= right)
+        {
+            SDL_Rect span = {left, y, right - left + 1, 1};
+            spans.push_back(span);
+        }
+    }
+
+    if (spans.empty())
+    {
+        return 0;
+    }
+    return SDL_RenderFillRects(this->sdlRender, &spans[0], spans.size());
+}
+
+/*
+ * Corrected image coordinates to window coordinates
+ */
+void distortionWindow::toWindow(const MapPoint *pt, int *x, int *y)
+{
+    *x = (int)(pt->x * this->sdlRect.w / this->corrected_width + 0.5F) + this->sdlRect.x;
+    *y = (int)(pt->y * this->sdlRect.h / this->corrected_height + 0.5F) + this->sdlRect.y;
+}
@@ -8,30 +8,40 @@
 #ifndef DISTORTION_WINDOW_H
 #define DISTORTION_WINDOW_H
 
+struct MapPoint;
+struct OverlayShapes;
+
 class distortionWindow
 {
 private:
-    int win_width;                      // width of origin window
-    int win_height;                     // height of origin window
+    int frame_width;                    // source frame, composite and layers
+    int frame_height;
+    int corrected_width;                // CorrectImageRGB output, scaled into the window
+    int corrected_height;
+    int win_width;                      // width of distortion window
+    int win_height;                     // height of distortion window
 
-    unsigned char *pDeRenderFrameBufferRGB;   // deRenderer buffer
-    unsigned char *pDeRenderFrameBufferARGB;   // deRenderer buffer
-    unsigned char *pDistortionFrameBuffer;   // deRenderer buffer
+    unsigned char *pCompositeFrameBufferBGR;  // all layers, source space
+    unsigned char *pDistortionFrameBuffer;   // corrected composite
 
     SDL_Window *sdlWindow;
     SDL_Renderer *sdlRender;
 
-    SDL_Texture *videoTexture;          // layer 1
-    SDL_Texture *rulerTexture;          // layer 2
-	SDL_Texture *faceTexture;
-	SDL_Texture *audioTexture;
-	SDL_Texture *cropTexture;
-
-    SDL_Texture *distortionTexture;
+    SDL_Texture *distortionTexture;     // video and ruler are composed on the CPU
+    SDL_Texture *labelTexture;          // face labels, drawn from the overlay shapes, one cell each
+    int labelCellWidth;                 // cell of the widest label
+    int labelCellHeight;
+    int labelCellsPerRow;
+    int labelNumber;                    // faces the cells were drawn for, -1 for none yet
+    int *pLabelPositions;               // and their boxes, MAX_FACE x 4
+    bool distortionValid;               // distortionTexture holds a corrected frame
 
     SDL_Rect sdlRect;                  // display position of window
 
     int refreshWindow(
+        unsigned int dirtyLayers,
+        const SDL_Rect *dirtyRects,
+        const OverlayShapes *pShapes,
         void *pVideoFrameBuffer,
         void *pRulerFrameBufferRGBA,
         void *pFaceFrameBuffer,
@@ -39,17 +49,29 @@ private:
         void *CropFrameBuffer
     );
 
-    int convertARGBtoRGB(
-        unsigned char *pArgb,
-        unsigned char *pRgb,
-        int w,
-        int h
+    // overlays as vectors, source coordinates mapped through the distortion
+    int drawOverlays(const OverlayShapes *pShapes);
+    bool drawLabels(const OverlayShapes *pShapes);
+    SDL_Rect labelCell(int index);
+    int drawRectOutline(int left, int top, int right, int bottom, int border);
+    int fillRect(int left, int top, int right, int bottom);
+    int drawPolyline(const MapPoint *pts, int n);
+    int fillPolygon(const MapPoint *pts, int n);
+    void toWindow(const MapPoint *pt, int *x, int *y);
+
+    int blendLayer(
+        const unsigned char *pRgba,
+        unsigned char *pBgr,
+        int pixels
     );
 
 public:
-    int init(int width, int height);
+    int init(int width, int height, int correctedWidth, int correctedHeight);
     int handleEvent(
         SDL_Event event,
+        unsigned int dirtyLayers,            // LAYER_xxx to re-upload
+        const SDL_Rect *dirtyRects,          // changed area, indexed by LAYER_xxx_INDEX
+        const OverlayShapes *pShapes,        // face/audio/crop geometry
         void *pVideoFrameBuffer,
         void *pRulerFrameBufferRGBA,
         void *pFaceFrameBuffer,
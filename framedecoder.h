@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Frame Decoder
+ *
+ * JPEG video frames decoded back to NV12 on a few threads. The network
+ * thread receives a frame into a free packet and submits it, a decoder
+ * thread decodes it with OpenCV and converts it to NV12 in a buffer of
+ * its own, then hands it to the output callback. Callbacks never run
+ * concurrently and never go back in sequence, a frame decoded after a
+ * newer one is dropped, the same "latest frame wins" as the frame ring.
+ *
+ * Senders encode frames converted by COLOR_YUV2BGR_NV12, the decoder
+ * inverts it with COLOR_BGR2YUV_I420, so the renderers get the camera
+ * NV12 back up to the JPEG loss.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _FRAME_DECODER_H_
+#define _FRAME_DECODER_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "autolock.h"
+
+#define MAX_DECODER 8
+#define DECODER_SPARE_PACKETS 2 // being received and waiting, besides one per thread
+
+/*
+ * A decoded frame, NV12 width x height, in decoding order
+ *  timestamp: capture time given to Submit()
+ */
+typedef void (*FRAME_DECODED_CB)(void *ctx, const unsigned char *nv12, uint32_t sequence, uint64_t timestamp);
+
+class FrameDecoder
+{
+public:
+    FrameDecoder()
+    {
+        width = height = 0;
+        packetsize = 0;
+        quit = false;
+        published = false;
+        last_sequence = 0;
+        decoded = late = failed = 0;
+        decoded_cb = NULL;
+        decoded_ctx = NULL;
+        pthread_mutex_init(&work_mtx, NULL);
+        pthread_cond_init(&work_cond, NULL);
+    }
+
+    virtual ~FrameDecoder()
+    {
+        Stop();
+        pthread_mutex_destroy(&work_mtx);
+        pthread_cond_destroy(&work_cond);
+    }
+
+    /*
+     * threads: decoder threads, packetsize: largest compressed frame,
+     * width x height: size every frame must decode to
+     */
+    bool Start(int threads, int packetsize, int width, int height, FRAME_DECODED_CB cb, void *ctx)
+    {
+        if(!tids.empty() || threads < 1 || packetsize <= 0 || width < 2 || height < 2 || NULL == cb)
+            return false;
+        if(threads > MAX_DECODER)
+            threads = MAX_DECODER;
+
+        this->packetsize = packetsize;
+        this->width = width;
+        this->height = height;
+        decoded_cb = cb;
+        decoded_ctx = ctx;
+        quit = false;
+        published = false;
+
+        packets.resize(threads + DECODER_SPARE_PACKETS);
+        for(size_t k = 0; k < packets.size(); k++)
+        {
+            packets[k].data.resize(packetsize);
+            free_packets.push_back(&packets[k]);
+        }
+
+        // OpenCV's own threads would only fight ours
+        cv::setNumThreads(1);
+
+        for(int k = 0; k < threads; k++)
+        {
+            pthread_t tid;
+            if(0 != pthread_create(&tid, NULL, decoder_proc, this))
+            {
+                printf("error: failed to create decoder thread %d.\n", k);
+                break;
+            }
+            tids.push_back(tid);
+        }
+        return !tids.empty();
+    }
+
+    void Stop()
+    {
+        pthread_mutex_lock(&work_mtx);
+        quit = true;
+        pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&work_mtx);
+
+        for(size_t k = 0; k < tids.size(); k++)
+            pthread_join(tids[k], NULL);
+        tids.clear();
+
+        queue.clear();
+        free_packets.clear();
+        packets.clear();
+    }
+
+    /*
+     * Buffer of packetsize bytes to receive a frame into
+     *  returns:  NULL if every packet is queued or decoding, the frame is dropped
+     */
+    unsigned char *GetPacket()
+    {
+        Packet *p = NULL;
+
+        pthread_mutex_lock(&work_mtx);
+        if(!free_packets.empty())
+        {
+            p = free_packets.back();
+            free_packets.pop_back();
+        }
+        pthread_mutex_unlock(&work_mtx);
+        return (p != NULL) ? &p->data[0] : NULL;
+    }
+
+    /*
+     * Queue a packet from GetPacket() holding a frame of size bytes
+     */
+    void Submit(unsigned char *data, int size, uint32_t sequence, uint64_t timestamp)
+    {
+        Packet *p = find_packet(data);
+
+        if(NULL == p)
+            return;
+        pthread_mutex_lock(&work_mtx);
+        p->size = size;
+        p->sequence = sequence;
+        p->timestamp = timestamp;
+        queue.push_back(p);
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&work_mtx);
+    }
+
+    // a packet from GetPacket() that is not submitted after all
+    void Release(unsigned char *data)
+    {
+        Packet *p = find_packet(data);
+
+        if(p != NULL)
+        {
+            pthread_mutex_lock(&work_mtx);
+            free_packets.push_back(p);
+            pthread_mutex_unlock(&work_mtx);
+        }
+    }
+
+    void GetStats(unsigned int *decoded, unsigned int *late, unsigned int *failed)
+    {
+        Autolock lock(&out_mtx);
+
+        *decoded = this->decoded;
+        *late = this->late;
+        *failed = this->failed;
+    }
+
+private:
+    struct Packet
+    {
+        std::vector<unsigned char> data;
+        int size;
+        uint32_t sequence;
+        uint64_t timestamp;
+    };
+
+    Packet *find_packet(unsigned char *data)
+    {
+        for(size_t k = 0; k < packets.size(); k++)
+            if(&packets[k].data[0] == data)
+                return &packets[k];
+        return NULL;
+    }
+
+    static void *decoder_proc(void *arg)
+    {
+        ((FrameDecoder *)arg)->run();
+        return NULL;
+    }
+
+    void run()
+    {
+        std::vector<unsigned char> nv12(width * height * 3 / 2);
+        cv::Mat bgr, i420;
+
+        while(1)
+        {
+            Packet *p;
+
+            pthread_mutex_lock(&work_mtx);
+            while(!quit && queue.empty())
+                pthread_cond_wait(&work_cond, &work_mtx);
+            if(quit)
+            {
+                pthread_mutex_unlock(&work_mtx);
+                break;
+            }
+            p = queue.front();
+            queue.pop_front();
+            pthread_mutex_unlock(&work_mtx);
+
+            uint32_t sequence = p->sequence;
+            uint64_t timestamp = p->timestamp;
+            bgr = cv::imdecode(cv::Mat(1, p->size, CV_8UC1, &p->data[0]), cv::IMREAD_COLOR);
+
+            // the compressed frame is not needed any more
+            pthread_mutex_lock(&work_mtx);
+            free_packets.push_back(p);
+            pthread_mutex_unlock(&work_mtx);
+
+            bool ok = !bgr.empty() && bgr.cols == width && bgr.rows == height;
+            if(ok)
+            {
+                cv::cvtColor(bgr, i420, cv::COLOR_BGR2YUV_I420);
+                i420_to_nv12(i420.data, &nv12[0]);
+            }
+
+            Autolock lock(&out_mtx);
+            if(!ok)
+            {
+                if(failed++ == 0)
+                    printf("error: frame %u does not decode to %dx%d, dropped\n", sequence, width, height);
+            }
+            else if(published && (int32_t)(sequence - last_sequence) <= 0)
+                late++; // a newer frame is on screen already
+            else
+            {
+                decoded_cb(decoded_ctx, &nv12[0], sequence, timestamp);
+                last_sequence = sequence;
+                published = true;
+                decoded++;
+            }
+        }
+    }
+
+    // planar U and V to the interleaved UV plane
+    void i420_to_nv12(const unsigned char *i420, unsigned char *nv12) const
+    {
+        const int ysize = width * height;
+        const int csize = ysize / 4;
+        const unsigned char *u = i420 + ysize;
+        const unsigned char *v = u + csize;
+        unsigned char *uv = nv12 + ysize;
+
+        memcpy(nv12, i420, ysize);
+        for(int k = 0; k < csize; k++)
+        {
+            uv[2*k] = u[k];
+            uv[2*k+1] = v[k];
+        }
+    }
+
+private:
+    int width;
+    int height;
+    int packetsize;
+
+    pthread_mutex_t work_mtx; // protect queue, free_packets and quit
+    pthread_cond_t work_cond;
+    bool quit;
+    std::vector<Packet> packets;
+    std::vector<Packet *> free_packets;
+    std::deque<Packet *> queue; // oldest first
+    std::vector<pthread_t> tids;
+
+    MutexLock out_mtx; // one callback at a time, in sequence
+    bool published;
+    uint32_t last_sequence;
+    unsigned int decoded;
+    unsigned int late;
+    unsigned int failed;
+    FRAME_DECODED_CB decoded_cb;
+    void *decoded_ctx;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Frame Ring
+ *
+ * 1. Latest-frame hand-off over N >= 3 preallocated slots, one writer
+ *     thread and one reader thread, no lock and no copy.
+ *
+ * 2. The writer fills a slot that is neither the latest nor the one being
+ *     read, then publishes it. The reader always gets the newest complete
+ *     frame, older unread ones are simply overwritten.
+ *
+ * 3. The slot returned by GetLatest() stays untouched until the reader
+ *     calls GetLatest() again.
+ *
+ * 4. The writer may hold written slots back, e.g. until what goes with
+ *     them has arrived, they are not handed out again until published or
+ *     released. N - 3 slots can be held at most.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _FRAME_RING_H_
+#define _FRAME_RING_H_
+
+#include <stdio.h>
+#include <atomic>
+
+#define FRAME_RING_MAX_SLOTS 32 // bits of the held mask
+
+class FrameRing
+{
+public:
+    FrameRing()
+    {
+        base = NULL;
+        slots = 0;
+        slotsize = 0;
+        held = 0;
+        latest.store(0);
+        reading.store(0);
+        published.store(0);
+    }
+
+    virtual ~FrameRing()
+    {
+    }
+
+    /*
+     * Attach to an allocated buffer of count * size bytes, not owned
+     * slot 0 counts as the latest frame until something is published
+     */
+    bool init(unsigned char *buf, int count, int size)
+    {
+        if(NULL == buf || count < 3 || count > FRAME_RING_MAX_SLOTS || size <= 0)
+        {
+            printf("error: frame ring needs 3 to %d slots, count=%d\n", FRAME_RING_MAX_SLOTS, count);
+            return false;
+        }
+
+        base = buf;
+        slots = count;
+        slotsize = size;
+        held = 0;
+        latest.store(0);
+        reading.store(0);
+        published.store(0);
+        return true;
+    }
+
+    // writer side
+
+    unsigned char *GetWriteSlot()
+    {
+        int l = latest.load();
+        int r = reading.load();
+        int k = (l + 1) % slots;
+
+        while(k == l || k == r || (held & (1u << k)))
+            k = (k + 1) % slots;
+        return base + (size_t)k * slotsize;
+    }
+
+    void Publish(unsigned char *slot)
+    {
+        held &= ~(1u << GetSlotIndex(slot));
+        latest.store(GetSlotIndex(slot)); // seq_cst, pairs with GetLatest
+        published.fetch_add(1);
+    }
+
+    // keep a written slot until Publish() or Release()
+    void Hold(unsigned char *slot)
+    {
+        held |= 1u << GetSlotIndex(slot);
+    }
+
+    // give a held slot back without publishing it
+    void Release(unsigned char *slot)
+    {
+        held &= ~(1u << GetSlotIndex(slot));
+    }
+
+    // reader side
+
+    unsigned char *GetLatest()
+    {
+        int l = latest.load();
+
+        // claim it, then make sure it was not replaced in between,
+        // otherwise the writer may have picked it before seeing the claim
+        while(1)
+        {
+            reading.store(l);
+            int now = latest.load();
+            if(now == l)
+                break;
+            l = now;
+        }
+
+        return base + (size_t)l * slotsize;
+    }
+
+    // 0 .. count-1, for state kept per slot beside the ring
+    int GetSlotIndex(const unsigned char *slot)
+    {
+        return (int)((slot - base) / slotsize);
+    }
+
+    // number of frames published so far
+    unsigned int GetPublished()
+    {
+        return published.load(std::memory_order_relaxed);
+    }
+
+private:
+    unsigned char *base;
+    int slots;
+    int slotsize;
+    unsigned int held; // writer only, bit k: slot k is held
+
+    std::atomic<int> latest;  // slot of the newest complete frame
+    std::atomic<int> reading; // slot the reader works on
+    std::atomic<unsigned int> published;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Jitter Buffer
+ *
+ * Metadata of one stream, e.g. face boxes, kept by capture timestamp
+ * until the video frame of that time is shown. A stream arrives in
+ * timestamp order, so this is a small ring: new entries at the head,
+ * frames are matched from the tail, and the oldest entry goes when it
+ * is full.
+ *
+ * The entry in effect at time t is the newest one not after t, it stays
+ * in effect for later frames until a newer one takes over.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _JITTER_BUFFER_H_
+#define _JITTER_BUFFER_H_
+
+#include <stdint.h>
+
+template<typename T, int N>
+class JitterBuffer
+{
+public:
+    JitterBuffer()
+    {
+        first = 0;
+        count = 0;
+        newest = 0;
+        shown = 0;
+        shown_valid = false;
+        overflows = 0;
+    }
+
+    virtual ~JitterBuffer()
+    {
+    }
+
+    void Push(uint64_t timestamp, const T &value)
+    {
+        if(count == N)
+        {
+            // the oldest one goes, lost unless it is the one in effect
+            if(!shown_valid || entries[first].timestamp != shown)
+                overflows++;
+            first = (first + 1) % N;
+            count--;
+        }
+
+        Entry &e = entries[(first + count) % N];
+        e.timestamp = timestamp;
+        e.value = value;
+        count++;
+        Advance(timestamp);
+    }
+
+    // nothing new up to timestamp, e.g. a heartbeat
+    void Advance(uint64_t timestamp)
+    {
+        if(timestamp > newest)
+            newest = timestamp;
+    }
+
+    // everything up to timestamp is in, nothing of that time can come any more
+    bool Covers(uint64_t timestamp) const
+    {
+        return newest >= timestamp;
+    }
+
+    /*
+     * Entry in effect at timestamp, older ones are dropped
+     *  returns:  NULL if it is the one Match() returned last time, or none
+     */
+    const T *Match(uint64_t timestamp)
+    {
+        int k = -1;
+
+        while(count > 0 && entries[first].timestamp <= timestamp)
+        {
+            k = first;
+            if(count == 1 || entries[(first + 1) % N].timestamp > timestamp)
+                break; // keep it, it is in effect until a newer one
+            first = (first + 1) % N;
+            count--;
+        }
+
+        if(k < 0 || (shown_valid && entries[k].timestamp == shown))
+            return NULL;
+        shown = entries[k].timestamp;
+        shown_valid = true;
+        return &entries[k].value;
+    }
+
+    // entries dropped unshown because the buffer was full
+    unsigned int GetOverflows() const
+    {
+        return overflows;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t timestamp;
+        T value;
+    };
+
+    Entry entries[N];
+    int first; // oldest
+    int count;
+    uint64_t newest; // timestamp of the latest entry or heartbeat
+    uint64_t shown; // timestamp of the entry Match() returned last
+    bool shown_valid;
+    unsigned int overflows;
+};
+
+#endif
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Lens Calibration
+ *
+ * Radius samples of a lens, distorted radius to corrected radius, in
+ * pixels of the calibration image, and the height of that image. The
+ * radii are scaled to whatever resolution the camera runs at, e.g. by
+ * 1/3 for 4K samples and a 720p camera.
+ *
+ * Text file, '#' starts a comment:
+ *
+ *     height 2160
+ *     0.000        0.000
+ *     21.89988272  19.30226677
+ *     ...
+ *
+ * Binary file, little endian: "LENS", u32 version (2), f32 height,
+ * u32 count, then count pairs of f32. Version 1 had the scale down to a
+ * 1280x720 source in place of the height and is converted on load.
+ *
+ * Both columns have to be ascending, each one is a lookup key.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _LENS_CALIB_H_
+#define _LENS_CALIB_H_
+
+#include <stdio.h>
+#include <stdlib.h> // strtof
+#include <math.h> // isfinite
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+
+#define LENS_CALIB_MAGIC "LENS"
+#define LENS_CALIB_VERSION 2
+#define LENS_CALIB_V1_HEIGHT 720 // source height version 1 scales were relative to
+#define LENS_CALIB_MAX_POINTS 4096
+#define LENS_CALIB_LINE_SIZE 256
+#define LENS_CALIB_MAX_RADIUS 8 // heights, far beyond the image corner even when corrected
+
+class LensCalibration
+{
+public:
+    LensCalibration()
+    {
+        height = 0.0F;
+    }
+
+    virtual ~LensCalibration()
+    {
+    }
+
+    /*
+     * pairs: n (distorted, corrected) radii, h: calibration image height
+     */
+    bool init(const float *pairs, int n, float h)
+    {
+        if(NULL == pairs || n <= 0)
+            return false;
+
+        source.resize(n);
+        corrected.resize(n);
+        for(int i = 0; i < n; i++)
+        {
+            source[i] = pairs[i*2];
+            corrected[i] = pairs[i*2+1];
+        }
+        height = h;
+        return check("built-in");
+    }
+
+    /*
+     * Text or binary, told apart by the magic
+     *  returns:  false if the file can not be read or is not a usable curve
+     */
+    bool Load(const char *path)
+    {
+        char magic[4];
+        bool ok;
+
+        FILE *fp = fopen(path, "rb");
+        if(NULL == fp)
+        {
+            printf("error: failed to open lens calibration %s\n", path);
+            return false;
+        }
+
+        source.clear();
+        corrected.clear();
+        height = 0.0F;
+
+        if(fread(magic, 1, 4, fp) == 4 && memcmp(magic, LENS_CALIB_MAGIC, 4) == 0)
+            ok = load_binary(fp, path);
+        else
+        {
+            rewind(fp);
+            ok = load_text(fp, path);
+        }
+        fclose(fp);
+
+        return ok && check(path);
+    }
+
+    // samples in pixels of a source image image_height pixels high
+    void GetRadii(int image_height, std::vector<float> &distorted, std::vector<float> &undistorted) const
+    {
+        float scale = height / image_height;
+
+        distorted.resize(source.size());
+        undistorted.resize(corrected.size());
+        for(size_t i = 0; i < source.size(); i++)
+        {
+            distorted[i] = source[i] / scale;
+            undistorted[i] = corrected[i] / scale;
+        }
+    }
+
+    int GetCount() const
+    {
+        return source.size();
+    }
+
+private:
+    bool load_text(FILE *fp, const char *path)
+    {
+        char line[LENS_CALIB_LINE_SIZE];
+        int lineno = 0;
+
+        while(fgets(line, sizeof(line), fp) != NULL)
+        {
+            char *p = line, *end;
+            float a, b;
+
+            lineno++;
+            if((end = strchr(line, '#')) != NULL)
+                *end = '\0';
+            while(*p == ' ' || *p == '\t')
+                p++;
+            if(*p == '\0' || *p == '\r' || *p == '\n')
+                continue;
+
+            if(strncmp(p, "scale", 5) == 0)
+            {
+                printf("error: %s:%d: scale is no longer supported, give the calibration image height\n", path, lineno);
+                return false;
+            }
+            if(strncmp(p, "height", 6) == 0)
+            {
+                height = strtof(p + 6, &end);
+                if(end == p + 6)
+                {
+                    printf("error: %s:%d: bad height\n", path, lineno);
+                    return false;
+                }
+                continue;
+            }
+
+            a = strtof(p, &end);
+            if(end == p)
+            {
+                printf("error: %s:%d: expect a radius pair\n", path, lineno);
+                return false;
+            }
+            p = end;
+            b = strtof(p, &end);
+            if(end == p)
+            {
+                printf("error: %s:%d: expect a radius pair\n", path, lineno);
+                return false;
+            }
+
+            if(source.size() >= LENS_CALIB_MAX_POINTS)
+            {
+                printf("error: %s: more than %d points\n", path, LENS_CALIB_MAX_POINTS);
+                return false;
+            }
+            source.push_back(a);
+            corrected.push_back(b);
+        }
+
+        return true;
+    }
+
+    bool load_binary(FILE *fp, const char *path)
+    {
+        uint32_t version, count;
+        float h;
+
+        if(fread(&version, sizeof(version), 1, fp) != 1 ||
+           fread(&h, sizeof(h), 1, fp) != 1 ||
+           fread(&count, sizeof(count), 1, fp) != 1)
+        {
+            printf("error: %s: truncated header\n", path);
+            return false;
+        }
+        if((version != 1 && version != LENS_CALIB_VERSION) || count > LENS_CALIB_MAX_POINTS)
+        {
+            printf("error: %s: version %u, %u points not supported\n", path, version, count);
+            return false;
+        }
+        if(version == 1)
+        {
+            // scale of calibration pixels per 720p source pixel
+            printf("info: %s: version 1, scale %g taken as height %g\n", path, h, h * LENS_CALIB_V1_HEIGHT);
+            h *= LENS_CALIB_V1_HEIGHT;
+        }
+
+        std::vector<float> pairs(count * 2);
+        if(count > 0 && fread(&pairs[0], sizeof(float), count * 2, fp) != count * 2)
+        {
+            printf("error: %s: truncated samples\n", path);
+            return false;
+        }
+
+        height = h;
+        for(uint32_t i = 0; i < count; i++)
+        {
+            source.push_back(pairs[i*2]);
+            corrected.push_back(pairs[i*2+1]);
+        }
+        return true;
+    }
+
+    // a usable curve goes up on both sides, so it can be looked up either way
+    bool check(const char *name) const
+    {
+        if(!(height > 0.0F) || !std::isfinite(height))
+        {
+            printf("error: %s: height %g is missing or not a positive number\n", name, height);
+            return false;
+        }
+        if(source.size() < 2)
+        {
+            printf("error: %s: needs 2 points at least, got %d\n", name, (int)source.size());
+            return false;
+        }
+        for(size_t i = 1; i < source.size(); i++)
+        {
+            if(!(source[i] > source[i-1]) || !(corrected[i] > corrected[i-1]))
+            {
+                printf("error: %s: radii not ascending at point %d\n", name, (int)i);
+                return false;
+            }
+        }
+        // ascending, so the last pair is the biggest, a reload must not size lookups by it
+        if(!std::isfinite(source[0]) || !std::isfinite(corrected[0]) ||
+           !(source.back() <= height * LENS_CALIB_MAX_RADIUS) || !(corrected.back() <= height * LENS_CALIB_MAX_RADIUS))
+        {
+            printf("error: %s: radii out of range, last %g, %g, at most %d times the height %g\n",
+                   name, source.back(), corrected.back(), LENS_CALIB_MAX_RADIUS, height);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    float height; // of the calibration image, pixels
+    std::vector<float> source; // distorted radii, calibration pixels
+    std::vector<float> corrected;
+};
+
+#endif
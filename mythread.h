@@ -28,6 +28,7 @@ public:
         cb = pfnCb;
         arg = param;
         run = false;
+        exited = false;
         pause = init_suspend;
         maxsec = exit_timeout;
         pthread_mutex_init(&exit_mtx, NULL);
@@ -64,6 +65,7 @@ public:
 
         // signal waiting threads that this thread is about to terminate
         pthread_mutex_lock(&pthis->exit_mtx);
+        pthis->exited = true;
         pthread_cond_broadcast(&pthis->exit_cond);
         pthread_mutex_unlock(&pthis->exit_mtx);
 
@@ -82,6 +84,7 @@ public:
         }
 
         run = true;
+        exited = false;
 
         if(0 != pthread_create(&tid, &attr, thread_proc, this))
         {
@@ -111,8 +114,11 @@ public:
             ts.tv_sec += maxsec; // max timeout seconds
 
             // wait (with timeout) until thread has finished
+            // it may be gone already if quit() was called before
             pthread_mutex_lock(&exit_mtx);
-            ret = pthread_cond_timedwait(&exit_cond, &exit_mtx, &ts);
+            ret = 0;
+            while(!exited && ret != ETIMEDOUT)
+                ret = pthread_cond_timedwait(&exit_cond, &exit_mtx, &ts);
             pthread_mutex_unlock(&exit_mtx);
         }
         else
@@ -131,6 +137,15 @@ public:
         }
     }
 
+    /*
+     * Ask the thread loop to end without waiting for it,
+     * so a blocked callback can be woken up before stop()
+     */
+    void quit()
+    {
+        run = false;
+    }
+
     void suspend()
     {
         pthread_mutex_lock(&suspend_mtx);
@@ -153,6 +168,7 @@ private:
     pthread_mutex_t suspend_mtx;
     pthread_cond_t suspend_cond;
     bool run;
+    bool exited; // thread_proc has left its loop
     bool pause;
     int maxsec;
     THREAD_PROC_CB cb;
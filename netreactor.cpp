@@ -0,0 +1,449 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Network Reactor
+ *
+ * Date Created: 20261017
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h> // uint64_t
+#include <limits.h> // INT_MAX
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "netreactor.h"
+
+#define DISCARD_BUFFER_SIZE 65536 // payloads nobody takes are read through it
+
+static long long monotonic_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+NetReactor::NetReactor()
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    tick_ms = 0;
+    tick_cb = NULL;
+    tick_ctx = NULL;
+
+    if(epfd < 0 || stopfd < 0)
+    {
+        printf("error: failed to create epoll/eventfd: %s\n", strerror(errno));
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = MAX_STREAM; // not a stream index
+    epoll_ctl(epfd, EPOLL_CTL_ADD, stopfd, &ev);
+}
+
+NetReactor::~NetReactor()
+{
+    Close();
+
+    if(stopfd >= 0)
+        close(stopfd);
+    if(epfd >= 0)
+        close(epfd);
+}
+
+int NetReactor::AddStream(const char *ip, int port, int msgsize, STREAM_BUF_CB getbuf, STREAM_MSG_CB onmsg, void *ctx, int mode)
+{
+    if(epfd < 0 || streams.size() >= MAX_STREAM || msgsize <= 0 || NULL == getbuf || NULL == onmsg ||
+       (mode != STREAM_RAW && mode != STREAM_FRAMED))
+        return -1;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr(ip);
+    address.sin_port = htons(port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        printf("error: failed to create socket for port %d: %s\n", port, strerror(errno));
+        return -1;
+    }
+
+    // usually in progress, finished by Run() on EPOLLOUT
+    bool connecting = false;
+    if(connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        if(errno != EINPROGRESS)
+        {
+            printf("error: failed to connect port %d: %s\n", port, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        connecting = true;
+    }
+
+    Stream s;
+    s.fd = fd;
+    s.port = port;
+    s.connecting = connecting;
+    s.connect_deadline = monotonic_ms() + NET_CONNECT_TIMEOUT;
+    s.mode = mode;
+    s.msgsize = msgsize;
+    s.received = 0;
+    s.dst = (mode == STREAM_RAW) ? getbuf(ctx) : NULL; // framed: once the header is in
+    memset(&s.hdr, 0, sizeof(s.hdr));
+    s.hdr.length = msgsize; // raw: every message, framed: set by each header
+    s.hdr_received = (mode == STREAM_RAW) ? sizeof(s.hdr) : 0;
+    s.synced = true;
+    s.skipped = 0;
+    s.next_sequence = 0;
+    memset(&s.stats, 0, sizeof(s.stats));
+    s.getbuf = getbuf;
+    s.onmsg = onmsg;
+    s.ctx = ctx;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = connecting ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
+    ev.data.u32 = streams.size();
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        printf("error: failed to watch port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    streams.push_back(s);
+    return streams.size() - 1;
+}
+
+void NetReactor::SetTick(int ms, REACTOR_TICK_CB cb, void *ctx)
+{
+    tick_ms = (ms > 0 && cb != NULL) ? ms : 0;
+    tick_cb = cb;
+    tick_ctx = ctx;
+}
+
+int NetReactor::Run()
+{
+    struct epoll_event events[MAX_STREAM + 1];
+    long long next_tick = monotonic_ms() + tick_ms;
+
+    if(epfd < 0)
+        return -1;
+
+    while(1)
+    {
+        long long now = monotonic_ms();
+        int timeout = -1;
+        if(tick_ms > 0)
+        {
+            if(now >= next_tick)
+            {
+                tick_cb(tick_ctx);
+                next_tick = now + tick_ms;
+            }
+            timeout = (int)(next_tick - now);
+        }
+
+        // wake up for the earliest connect deadline too
+        for(size_t k = 0; k < streams.size(); k++)
+        {
+            if(!streams[k].connecting)
+                continue;
+            if(now >= streams[k].connect_deadline)
+            {
+                printf("error: failed to connect port %d: no answer in %d ms\n", streams[k].port, NET_CONNECT_TIMEOUT);
+                return -1;
+            }
+            if(timeout < 0 || streams[k].connect_deadline - now < timeout)
+                timeout = (int)(streams[k].connect_deadline - now);
+        }
+
+        int n = epoll_wait(epfd, events, MAX_STREAM + 1, timeout);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            printf("error: epoll_wait failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        for(int k = 0; k < n; k++)
+        {
+            unsigned int index = events[k].data.u32;
+            if(index == MAX_STREAM)
+            {
+                uint64_t val;
+                if(read(stopfd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+                    printf("error: failed to drain stop event: %s\n", strerror(errno)); // stop anyway
+                return 0;
+            }
+
+            if(streams[index].connecting)
+            {
+                if(!finish_connect(index))
+                    return -1;
+                continue;
+            }
+
+            if(!read_stream(streams[index]))
+                return -1;
+        }
+    }
+}
+
+void NetReactor::Stop()
+{
+    uint64_t one = 1;
+    if(write(stopfd, &one, sizeof(one)) < 0)
+        printf("error: failed to stop reactor: %s\n", strerror(errno));
+}
+
+bool NetReactor::TakeStats(int index, StreamStats *stats)
+{
+    if(index < 0 || index >= (int)streams.size() || NULL == stats)
+        return false;
+
+    StreamStats &s = streams[index].stats;
+    *stats = s;
+    s.latency_count = 0;
+    s.latency_sum = 0;
+    s.latency_max = 0;
+    return true;
+}
+
+void NetReactor::Close()
+{
+    for(size_t k = 0; k < streams.size(); k++)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, streams[k].fd, NULL);
+        close(streams[k].fd);
+    }
+    streams.clear();
+}
+
+/*
+ * A connect in progress is done, successful or not
+ */
+bool NetReactor::finish_connect(int index)
+{
+    Stream &s = streams[index];
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if(getsockopt(s.fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+        err = errno;
+    if(err != 0)
+    {
+        printf("error: failed to connect port %d: %s\n", s.port, strerror(err));
+        return false;
+    }
+
+    // from now on only the traffic
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u32 = index;
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, s.fd, &ev) == -1)
+    {
+        printf("error: failed to watch port %d: %s\n", s.port, strerror(errno));
+        return false;
+    }
+
+    s.connecting = false;
+    printf("info: port %d connected\n", s.port);
+    return true;
+}
+
+/*
+ * Drain what the socket has, up to MAX_MSG_PER_WAKEUP messages,
+ * level triggered epoll comes back for the rest
+ */
+bool NetReactor::read_stream(Stream &s)
+{
+    static unsigned char discard[DISCARD_BUFFER_SIZE]; // only the reactor thread reads into it
+    const int HDRSIZE = sizeof(StreamFrameHeader);
+    int done = 0;
+
+    while(done < MAX_MSG_PER_WAKEUP)
+    {
+        // header first, then the payload straight into the handler buffer
+        bool header = s.hdr_received < HDRSIZE;
+        int left = s.hdr.length - s.received;
+        ssize_t ret = header ? recv(s.fd, (unsigned char *)&s.hdr + s.hdr_received, HDRSIZE - s.hdr_received, 0)
+                    : (s.dst != NULL) ? recv(s.fd, s.dst + s.received, left, 0)
+                    : recv(s.fd, discard, left < DISCARD_BUFFER_SIZE ? left : DISCARD_BUFFER_SIZE, 0);
+
+        if(ret > 0)
+        {
+            if(header)
+            {
+                s.hdr_received += ret;
+                if(s.hdr_received < HDRSIZE)
+                    continue;
+                if(!check_header(s))
+                {
+                    resync(s);
+                    continue;
+                }
+                if(s.hdr.length > (uint32_t)s.msgsize)
+                {
+                    // no buffer holds it, received into discard and counted by deliver
+                    printf("warning: port %d: sequence %u, payload %u bytes over %d, discarded\n",
+                           s.port, s.hdr.sequence, s.hdr.length, s.msgsize);
+                    s.dst = NULL;
+                    continue;
+                }
+                if(s.hdr.length > 0)
+                {
+                    s.dst = s.getbuf(s.ctx);
+                    continue;
+                }
+            }
+            else
+            {
+                s.received += ret;
+                if(s.received < (int)s.hdr.length)
+                    continue;
+            }
+
+            deliver(s);
+            done++;
+        }
+        else if(ret == 0)
+        {
+            printf("error: port %d closed by peer.\n", s.port);
+            return false;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+        else if(errno != EINTR)
+        {
+            printf("error: failed to receive on port %d: %s\n", s.port, strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * A complete header of a framed stream, see streamframe.h
+ *  a payload bigger than msgsize is still well framed, read_stream skips it
+ */
+bool NetReactor::check_header(Stream &s)
+{
+    const StreamFrameHeader &h = s.hdr;
+
+    if(h.magic != STREAM_FRAME_MAGIC || h.version != STREAM_FRAME_VERSION ||
+       h.header_size != sizeof(StreamFrameHeader) || h.length > (uint32_t)INT_MAX)
+    {
+        if(s.synced && h.magic == STREAM_FRAME_MAGIC)
+            printf("error: port %d: version %u, header %u bytes, payload %u bytes not supported\n",
+                   s.port, h.version, h.header_size, h.length);
+        return false;
+    }
+
+    if(!s.synced)
+    {
+        printf("info: port %d: framing found again, %d bytes skipped\n", s.port, s.skipped);
+        s.synced = true;
+        s.skipped = 0;
+    }
+    return true;
+}
+
+/*
+ * Throw away bytes up to the next possible magic in the header buffer,
+ * the rest of the header comes from the socket as usual
+ */
+void NetReactor::resync(Stream &s)
+{
+    const uint32_t magic = STREAM_FRAME_MAGIC;
+    unsigned char *p = (unsigned char *)&s.hdr;
+    int k;
+
+    if(s.synced)
+    {
+        printf("error: port %d: lost the framing after %u messages\n", s.port, s.stats.messages);
+        s.synced = false;
+        s.stats.resyncs++;
+    }
+
+    // a prefix of the magic may be at the end
+    for(k = 1; k < s.hdr_received; k++)
+    {
+        int n = s.hdr_received - k;
+        if(memcmp(p + k, &magic, n < 4 ? n : 4) == 0)
+            break;
+    }
+    memmove(p, p + k, s.hdr_received - k);
+    s.hdr_received -= k;
+    s.skipped += k;
+}
+
+/*
+ * Hand a complete message over and start the next one
+ */
+void NetReactor::deliver(Stream &s)
+{
+    StreamStats &st = s.stats;
+
+    if(s.mode == STREAM_RAW)
+    {
+        s.hdr.sequence = s.next_sequence; // counted here, nothing can be dropped
+        s.hdr.format = STREAM_FORMAT_RAW;
+    }
+    else
+    {
+        if(st.messages > 0 && s.hdr.sequence != s.next_sequence)
+        {
+            uint32_t gap = s.hdr.sequence - s.next_sequence;
+            if(gap < 0x80000000u)
+            {
+                printf("warning: port %d: %u messages dropped before sequence %u\n", s.port, gap, s.hdr.sequence);
+                st.dropped += gap;
+            }
+            else
+                printf("warning: port %d: sequence went back to %u, sender restarted?\n", s.port, s.hdr.sequence);
+        }
+
+        if(s.hdr.timestamp != 0)
+        {
+            int64_t latency = (int64_t)(StreamFrameClock() - s.hdr.timestamp);
+            st.latency_sum += latency;
+            st.latency_max = (st.latency_count == 0 || latency > st.latency_max) ? latency : st.latency_max;
+            st.latency_count++;
+        }
+    }
+    s.next_sequence = s.hdr.sequence + 1;
+    st.messages++;
+
+    if(s.hdr.length == 0)
+        s.onmsg(s.ctx, NULL, 0, &s.hdr); // heartbeat
+    else if(s.dst != NULL)
+        s.onmsg(s.ctx, s.dst, s.hdr.length, &s.hdr);
+    else
+        st.discarded++;
+
+    s.received = 0;
+    if(s.mode == STREAM_RAW)
+        s.dst = s.getbuf(s.ctx);
+    else
+    {
+        s.dst = NULL;
+        s.hdr_received = 0;
+    }
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Network Reactor
+ *
+ * One thread, one epoll set, all uvd streams. Sockets are non-blocking,
+ * connects included, every stream reassembles its messages incrementally
+ * and hands each complete one to its handler.
+ *
+ * A stream is either legacy raw, fixed size messages back to back, or
+ * framed, a StreamFrameHeader in front of every message (streamframe.h).
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _NET_REACTOR_H_
+#define _NET_REACTOR_H_
+
+#include <stdint.h>
+#include <vector>
+#include "streamframe.h"
+
+#define MAX_STREAM 8
+#define MAX_MSG_PER_WAKEUP 4 // keep one bursting stream from starving the others
+#define NET_CONNECT_TIMEOUT 5000 // ms for a connect to complete in Run()
+
+/*
+ * Where to receive the next message of a stream, msgsize bytes at least
+ * asked once the header of a framed message is in, NULL drops the message
+ */
+typedef unsigned char *(*STREAM_BUF_CB)(void *ctx);
+
+/*
+ * A message is complete in the buffer returned by STREAM_BUF_CB
+ *  hdr: its header, made up for a raw stream (no timestamp, format RAW)
+ *  a heartbeat of a framed stream comes with msg NULL and size 0
+ */
+typedef void (*STREAM_MSG_CB)(void *ctx, unsigned char *msg, int size, const StreamFrameHeader *hdr);
+
+/*
+ * Called on the reactor thread every tick, see SetTick()
+ */
+typedef void (*REACTOR_TICK_CB)(void *ctx);
+
+enum StreamMode
+{
+    STREAM_RAW, // legacy, no header
+    STREAM_FRAMED
+};
+
+struct StreamStats
+{
+    unsigned int messages;
+    unsigned int dropped; // gaps in the sequence
+    unsigned int resyncs; // times the framing was lost
+    unsigned int discarded; // no buffer to receive into, or too big for it
+    // since the last TakeStats(), framed streams with a timestamp only
+    int latency_count;
+    int64_t latency_sum; // microseconds, capture to received
+    int64_t latency_max;
+};
+
+class NetReactor
+{
+public:
+    NetReactor();
+    virtual ~NetReactor();
+
+    /*
+     * Start connecting to ip:port and register the stream, Run() finishes
+     * the connect, so a slow port does not hold up the others
+     *  msgsize: size of a raw message, the largest payload of a framed one
+     *  returns stream index, -1 on error
+     */
+    int AddStream(const char *ip, int port, int msgsize, STREAM_BUF_CB getbuf, STREAM_MSG_CB onmsg, void *ctx,
+                  int mode = STREAM_RAW);
+
+    /*
+     * Call cb every ms milliseconds while Run() waits, e.g. for deadlines
+     * no message brings along, ms <= 0 turns it off
+     */
+    void SetTick(int ms, REACTOR_TICK_CB cb, void *ctx);
+
+    /*
+     * Counters of a stream, the latency ones start over
+     * call on the reactor thread, e.g. from a handler
+     */
+    bool TakeStats(int index, StreamStats *stats);
+
+    /*
+     * Dispatch until Stop() or a stream fails
+     *  returns 0 on Stop(), -1 on error, peer close or a connect that
+     *  fails or takes longer than NET_CONNECT_TIMEOUT
+     */
+    int Run();
+
+    /*
+     * Make Run() return, callable from any thread
+     */
+    void Stop();
+
+    // close every stream
+    void Close();
+
+private:
+    struct Stream
+    {
+        int fd;
+        int port;
+        bool connecting; // waiting for EPOLLOUT
+        long long connect_deadline; // monotonic ms
+        int mode;
+        int msgsize;
+        int received; // payload bytes of the current message
+        unsigned char *dst; // current message buffer, NULL if it is thrown away
+        StreamFrameHeader hdr; // of the current message
+        int hdr_received; // bytes of hdr, sizeof(hdr) once it is complete
+        bool synced; // framing found, nothing skipped since
+        int skipped; // bytes thrown away looking for the next header
+        uint32_t next_sequence;
+        StreamStats stats;
+        STREAM_BUF_CB getbuf;
+        STREAM_MSG_CB onmsg;
+        void *ctx;
+    };
+
+    bool finish_connect(int index);
+    bool read_stream(Stream &s);
+    bool check_header(Stream &s);
+    void resync(Stream &s);
+    void deliver(Stream &s);
+
+private:
+    int epfd;
+    int stopfd; // eventfd, readable after Stop()
+    int tick_ms;
+    REACTOR_TICK_CB tick_cb;
+    void *tick_ctx;
+    std::vector<Stream> streams;
+};
+
+#endif
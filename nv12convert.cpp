@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * NV12 to RGB24 conversion
+ *
+ * Date Created: 20261017
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include "nv12convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NV12_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*NV12_ROW_PROC)(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width);
+
+/*
+ * Interleave converted planes into RGB24
+ */
+static inline void interleave_rgb24(const unsigned char *c0, const unsigned char *c1, const unsigned char *c2, unsigned char *rgb, int n)
+{
+    for(int k = 0; k < n; k++)
+    {
+        rgb[3*k] = c0[k];
+        rgb[3*k+1] = c1[k];
+        rgb[3*k+2] = c2[k];
+    }
+}
+
+static void convert_row_scalar(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    int j;
+    for(j = 0; j < width; j++)
+    {
+        int uIdx = (j / 2) * 2;
+        nv12_pixel(y[j], uv[uIdx], uv[uIdx+1], &rgb[3*j]);
+    }
+}
+
+static void convert_row444_scalar(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    int j;
+    for(j = 0; j < width; j++)
+        nv12_pixel(y[j], uv[2*j], uv[2*j+1], &rgb[3*j]);
+}
+
+#ifdef NV12_X86
+
+static inline void yuv_core_sse2(__m128i y16, __m128i u, __m128i v, __m128i &out0, __m128i &out1, __m128i &out2)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i round = _mm_set1_epi16(2);
+
+    u = _mm_slli_epi16(_mm_sub_epi16(u, bias), 6);
+    v = _mm_slli_epi16(_mm_sub_epi16(v, bias), 6);
+    y16 = _mm_add_epi16(_mm_slli_epi16(y16, 2), round);
+
+    out0 = _mm_srai_epi16(_mm_add_epi16(y16, _mm_mulhi_epi16(u, _mm_set1_epi16(NV12_COEF_C0_U))), 2);
+    out1 = _mm_srai_epi16(_mm_sub_epi16(_mm_sub_epi16(y16, _mm_mulhi_epi16(u, _mm_set1_epi16(NV12_COEF_C1_U))),
+                                        _mm_mulhi_epi16(v, _mm_set1_epi16(NV12_COEF_C1_V))), 2);
+    out2 = _mm_srai_epi16(_mm_add_epi16(y16, _mm_mulhi_epi16(v, _mm_set1_epi16(NV12_COEF_C2_V))), 2);
+}
+
+static void convert_row_sse2(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned char c0[16], c1[16], c2[16];
+    int j;
+
+    for(j = 0; j + 16 <= width; j += 16)
+    {
+        __m128i yy = _mm_loadu_si128((const __m128i *)(y + j));
+        __m128i cc = _mm_loadu_si128((const __m128i *)(uv + j)); // 8 pairs of u,v
+        __m128i out0[2], out1[2], out2[2];
+
+        for(int h = 0; h < 2; h++)
+        {
+            __m128i y16 = h ? _mm_unpackhi_epi8(yy, zero) : _mm_unpacklo_epi8(yy, zero);
+            __m128i uv16 = h ? _mm_unpackhi_epi8(cc, zero) : _mm_unpacklo_epi8(cc, zero);
+
+            // every chroma pair is shared by two pixels
+            __m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv16, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0));
+            __m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv16, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+            yuv_core_sse2(y16, u, v, out0[h], out1[h], out2[h]);
+        }
+
+        // saturation is the clamp to [0, 255]
+        _mm_storeu_si128((__m128i *)c0, _mm_packus_epi16(out0[0], out0[1]));
+        _mm_storeu_si128((__m128i *)c1, _mm_packus_epi16(out1[0], out1[1]));
+        _mm_storeu_si128((__m128i *)c2, _mm_packus_epi16(out2[0], out2[1]));
+        interleave_rgb24(c0, c1, c2, rgb + 3*j, 16);
+    }
+
+    // tail
+    for(; j < width; j++)
+    {
+        int uIdx = (j / 2) * 2;
+        nv12_pixel(y[j], uv[uIdx], uv[uIdx+1], &rgb[3*j]);
+    }
+}
+
+static void convert_row444_sse2(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowbyte = _mm_set1_epi16(0xff);
+    unsigned char c0[16], c1[16], c2[16];
+    int j;
+
+    for(j = 0; j + 16 <= width; j += 16)
+    {
+        __m128i yy = _mm_loadu_si128((const __m128i *)(y + j));
+        __m128i out0[2], out1[2], out2[2];
+
+        for(int h = 0; h < 2; h++)
+        {
+            __m128i y16 = h ? _mm_unpackhi_epi8(yy, zero) : _mm_unpacklo_epi8(yy, zero);
+            __m128i uv16 = _mm_loadu_si128((const __m128i *)(uv + 2*j + 16*h)); // 8 pairs of u,v
+
+            // one chroma pair per pixel
+            __m128i u = _mm_and_si128(uv16, lowbyte);
+            __m128i v = _mm_srli_epi16(uv16, 8);
+            yuv_core_sse2(y16, u, v, out0[h], out1[h], out2[h]);
+        }
+
+        _mm_storeu_si128((__m128i *)c0, _mm_packus_epi16(out0[0], out0[1]));
+        _mm_storeu_si128((__m128i *)c1, _mm_packus_epi16(out1[0], out1[1]));
+        _mm_storeu_si128((__m128i *)c2, _mm_packus_epi16(out2[0], out2[1]));
+        interleave_rgb24(c0, c1, c2, rgb + 3*j, 16);
+    }
+
+    for(; j < width; j++)
+        nv12_pixel(y[j], uv[2*j], uv[2*j+1], &rgb[3*j]);
+}
+
+__attribute__((target("avx2")))
+static inline void yuv_core_avx2(__m256i y16, __m256i u, __m256i v, __m256i &out0, __m256i &out1, __m256i &out2)
+{
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i round = _mm256_set1_epi16(2);
+
+    u = _mm256_slli_epi16(_mm256_sub_epi16(u, bias), 6);
+    v = _mm256_slli_epi16(_mm256_sub_epi16(v, bias), 6);
+    y16 = _mm256_add_epi16(_mm256_slli_epi16(y16, 2), round);
+
+    out0 = _mm256_srai_epi16(_mm256_add_epi16(y16, _mm256_mulhi_epi16(u, _mm256_set1_epi16(NV12_COEF_C0_U))), 2);
+    out1 = _mm256_srai_epi16(_mm256_sub_epi16(_mm256_sub_epi16(y16, _mm256_mulhi_epi16(u, _mm256_set1_epi16(NV12_COEF_C1_U))),
+                                              _mm256_mulhi_epi16(v, _mm256_set1_epi16(NV12_COEF_C1_V))), 2);
+    out2 = _mm256_srai_epi16(_mm256_add_epi16(y16, _mm256_mulhi_epi16(v, _mm256_set1_epi16(NV12_COEF_C2_V))), 2);
+}
+
+__attribute__((target("avx2")))
+static void convert_row_avx2(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned char c0[32], c1[32], c2[32];
+    int j;
+
+    for(j = 0; j + 32 <= width; j += 32)
+    {
+        // unpack works inside 128-bit lanes for both y and uv,
+        // so pixels and chroma pairs stay lined up
+        __m256i yy = _mm256_loadu_si256((const __m256i *)(y + j));
+        __m256i cc = _mm256_loadu_si256((const __m256i *)(uv + j)); // 16 pairs of u,v
+        __m256i out0[2], out1[2], out2[2];
+
+        for(int h = 0; h < 2; h++)
+        {
+            __m256i y16 = h ? _mm256_unpackhi_epi8(yy, zero) : _mm256_unpacklo_epi8(yy, zero);
+            __m256i uv16 = h ? _mm256_unpackhi_epi8(cc, zero) : _mm256_unpacklo_epi8(cc, zero);
+
+            __m256i u = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv16, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0));
+            __m256i v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv16, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+            yuv_core_avx2(y16, u, v, out0[h], out1[h], out2[h]);
+        }
+
+        // packus is per lane as well, which gives back pixel order
+        _mm256_storeu_si256((__m256i *)c0, _mm256_packus_epi16(out0[0], out0[1]));
+        _mm256_storeu_si256((__m256i *)c1, _mm256_packus_epi16(out1[0], out1[1]));
+        _mm256_storeu_si256((__m256i *)c2, _mm256_packus_epi16(out2[0], out2[1]));
+        interleave_rgb24(c0, c1, c2, rgb + 3*j, 32);
+    }
+
+    // tail, at most 31 pixels
+    if(j < width)
+        convert_row_sse2(y + j, uv + j, rgb + 3*j, width - j);
+}
+
+__attribute__((target("avx2")))
+static void convert_row444_avx2(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lowbyte = _mm256_set1_epi16(0xff);
+    unsigned char c0[32], c1[32], c2[32];
+    int j;
+
+    for(j = 0; j + 32 <= width; j += 32)
+    {
+        // lane order of the unpacked y is pixels 0-7,16-23 / 8-15,24-31,
+        // load the chroma pairs the same way
+        __m256i yy = _mm256_loadu_si256((const __m256i *)(y + j));
+        __m256i out0[2], out1[2], out2[2];
+
+        for(int h = 0; h < 2; h++)
+        {
+            __m256i y16 = h ? _mm256_unpackhi_epi8(yy, zero) : _mm256_unpacklo_epi8(yy, zero);
+            __m256i uv16 = _mm256_loadu2_m128i((const __m128i *)(uv + 2*j + 32 + 16*h),
+                                               (const __m128i *)(uv + 2*j + 16*h));
+
+            __m256i u = _mm256_and_si256(uv16, lowbyte);
+            __m256i v = _mm256_srli_epi16(uv16, 8);
+            yuv_core_avx2(y16, u, v, out0[h], out1[h], out2[h]);
+        }
+
+        _mm256_storeu_si256((__m256i *)c0, _mm256_packus_epi16(out0[0], out0[1]));
+        _mm256_storeu_si256((__m256i *)c1, _mm256_packus_epi16(out1[0], out1[1]));
+        _mm256_storeu_si256((__m256i *)c2, _mm256_packus_epi16(out2[0], out2[1]));
+        interleave_rgb24(c0, c1, c2, rgb + 3*j, 32);
+    }
+
+    if(j < width)
+        convert_row444_sse2(y + j, uv + 2*j, rgb + 3*j, width - j);
+}
+
+#endif // NV12_X86
+
+// best implementation of this CPU, detected once
+static int detect_impl()
+{
+#ifdef NV12_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return NV12_IMPL_AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return NV12_IMPL_SSE2;
+#endif
+    return NV12_IMPL_SCALAR;
+}
+
+static NV12_ROW_PROC row444_proc(int impl)
+{
+    switch(impl)
+    {
+#ifdef NV12_X86
+    case NV12_IMPL_AVX2:
+        return convert_row444_avx2;
+    case NV12_IMPL_SSE2:
+        return convert_row444_sse2;
+#endif
+    default:
+        return convert_row444_scalar;
+    }
+}
+
+static NV12_ROW_PROC row_proc(int impl)
+{
+    switch(impl)
+    {
+#ifdef NV12_X86
+    case NV12_IMPL_AVX2:
+        return convert_row_avx2;
+    case NV12_IMPL_SSE2:
+        return convert_row_sse2;
+#endif
+    default:
+        return convert_row_scalar;
+    }
+}
+
+struct NV12_PROCS
+{
+    int impl;
+    NV12_ROW_PROC row;
+    NV12_ROW_PROC row444;
+};
+
+/*
+ * Procs of every implementation, built on first use, globals may convert
+ * before main. Function-local statics are initialized once even when
+ * several threads convert at the same time.
+ */
+static const NV12_PROCS *impl_procs(int impl)
+{
+    static const NV12_PROCS procs[] = {
+        {NV12_IMPL_SCALAR, row_proc(NV12_IMPL_SCALAR), row444_proc(NV12_IMPL_SCALAR)},
+        {NV12_IMPL_SSE2, row_proc(NV12_IMPL_SSE2), row444_proc(NV12_IMPL_SSE2)},
+        {NV12_IMPL_AVX2, row_proc(NV12_IMPL_AVX2), row444_proc(NV12_IMPL_AVX2)},
+    };
+
+    return &procs[impl];
+}
+
+static int supported_impl()
+{
+    static const int impl = detect_impl();
+
+    return impl;
+}
+
+// NULL until nv12_set_impl(), the best supported one then
+static std::atomic<const NV12_PROCS *> cur_procs(NULL);
+
+static const NV12_PROCS *get_procs()
+{
+    const NV12_PROCS *procs = cur_procs.load(std::memory_order_acquire);
+
+    return (procs != NULL) ? procs : impl_procs(supported_impl());
+}
+
+int nv12_get_impl()
+{
+    return get_procs()->impl;
+}
+
+bool nv12_set_impl(int impl)
+{
+    if(impl < NV12_IMPL_SCALAR || impl > supported_impl())
+        return false;
+    cur_procs.store(impl_procs(impl), std::memory_order_release);
+    return true;
+}
+
+void nv12_to_rgb24_rows(const unsigned char *yuv, unsigned char *rgb, int width, int height, int row_begin, int row_end)
+{
+    const unsigned char *uvData = yuv + width * height;
+    const NV12_ROW_PROC proc = get_procs()->row;
+    int i;
+
+    for(i = row_begin; i < row_end; i++)
+        proc(yuv + i * width, uvData + (i / 2) * width, rgb + i * width * 3, width);
+}
+
+void nv12_to_rgb24(const unsigned char *yuv, unsigned char *rgb, int width, int height)
+{
+    nv12_to_rgb24_rows(yuv, rgb, width, height, 0, height);
+}
+
+void yuv444_to_rgb24_row(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width)
+{
+    get_procs()->row444(y, uv, rgb, width);
+}
+
+
+/****************************************************/
+/* Unit Test */
+
+/*
+ * bit-exactness of every supported implementation against scalar
+ *  g++ -std=c++17 -O2 -DUNIT_TEST nv12convert.cpp -o nv12test.out
+ */
+#ifdef UNIT_TEST
+
+#include <stdlib.h>
+#include <vector>
+
+int main()
+{
+    const int sizes[][2] = {{1280, 720}, {1920, 1080}, {64, 2}, {46, 6}, {18, 4}, {2, 2}};
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    int failed = 0;
+
+    srand(1);
+
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int w = sizes[s][0], h = sizes[s][1];
+        std::vector<unsigned char> yuv(w * h * 3 / 2);
+        std::vector<unsigned char> ref(w * h * 3), out(w * h * 3);
+        std::vector<unsigned char> ref444(w * 3), out444(w * 3);
+
+        for(size_t k = 0; k < yuv.size(); k++)
+            yuv[k] = rand() & 0xff;
+        // extremes hit saturation on every channel
+        yuv[0] = 0; yuv[1] = 255;
+        yuv[w * h] = 0; yuv[w * h + 1] = 255;
+
+        nv12_set_impl(NV12_IMPL_SCALAR);
+        nv12_to_rgb24(&yuv[0], &ref[0], w, h);
+
+        for(int impl = NV12_IMPL_SSE2; impl <= NV12_IMPL_AVX2; impl++)
+        {
+            if(!nv12_set_impl(impl))
+            {
+                printf("skip %s: not supported\n", names[impl]);
+                continue;
+            }
+
+            memset(&out[0], 0, out.size());
+            nv12_to_rgb24(&yuv[0], &out[0], w, h);
+            bool same = (0 == memcmp(&ref[0], &out[0], out.size()));
+
+            // chroma per pixel: y plane as luma, random bytes as u,v pairs
+            nv12_set_impl(NV12_IMPL_SCALAR);
+            yuv444_to_rgb24_row(&yuv[0], &yuv[w], &ref444[0], w);
+            nv12_set_impl(impl);
+            yuv444_to_rgb24_row(&yuv[0], &yuv[w], &out444[0], w);
+            same = same && (0 == memcmp(&ref444[0], &out444[0], out444.size()));
+            printf("%s %dx%d: %s\n", names[impl], w, h, same ? "ok" : "MISMATCH");
+            failed += same ? 0 : 1;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
+
+#endif
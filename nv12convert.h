@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * NV12 to RGB24 conversion
+ *
+ * BT.601 with integer coefficients, scalar/SSE2/AVX2 implementations
+ * produce the very same bytes, the fastest one is picked by CPUID.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _NV12_CONVERT_H_
+#define _NV12_CONVERT_H_
+
+enum Nv12Impl
+{
+    NV12_IMPL_SCALAR,
+    NV12_IMPL_SSE2,
+    NV12_IMPL_AVX2
+};
+
+/*
+ * Coefficients in units of 1/4096, applied to (chroma - 128) << 6 and
+ * kept as the high 16 bits of the product, which leaves the chroma terms
+ * in quarter units (the same as _mm_mulhi_epi16)
+ */
+#define NV12_COEF_C0_U 5614 // 1.370705
+#define NV12_COEF_C1_U 2859 // 0.698001
+#define NV12_COEF_C1_V 2880 // 0.703125
+#define NV12_COEF_C2_V 7096 // 1.732446
+
+inline int nv12_chroma_term(int c, int coef)
+{
+    return ((c - 128) * 64 * coef) >> 16;
+}
+
+inline unsigned char nv12_clamp(int x)
+{
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+/*
+ * Convert a single pixel, reference of all implementations
+ *  out: 3 bytes, the same channel order as NV12_to_RGB24 always had
+ */
+inline void nv12_pixel(int y, int u, int v, unsigned char *out)
+{
+    y <<= 2;
+    out[0] = nv12_clamp((y + nv12_chroma_term(u, NV12_COEF_C0_U) + 2) >> 2);
+    out[1] = nv12_clamp((y - nv12_chroma_term(u, NV12_COEF_C1_U) - nv12_chroma_term(v, NV12_COEF_C1_V) + 2) >> 2);
+    out[2] = nv12_clamp((y + nv12_chroma_term(v, NV12_COEF_C2_V) + 2) >> 2);
+}
+
+/*
+ * Convert rows [row_begin, row_end) of a NV12 image
+ *  yuv: NV12 image, width * height * 3 / 2 bytes
+ *  rgb: RGB24 image, width * height * 3 bytes
+ */
+void nv12_to_rgb24_rows(const unsigned char *yuv, unsigned char *rgb, int width, int height, int row_begin, int row_end);
+
+/*
+ * Convert a whole image with the dispatched implementation
+ */
+void nv12_to_rgb24(const unsigned char *yuv, unsigned char *rgb, int width, int height);
+
+/*
+ * Convert a row with one chroma pair per pixel
+ *  y: width bytes of luma
+ *  uv: width pairs of u,v
+ *  rgb: width * 3 bytes
+ */
+void yuv444_to_rgb24_row(const unsigned char *y, const unsigned char *uv, unsigned char *rgb, int width);
+
+/*
+ * Implementation in use, and forcing one (e.g. to compare against scalar)
+ *  returns false if the cpu does not support it
+ */
+int nv12_get_impl();
+bool nv12_set_impl(int impl);
+
+#endif
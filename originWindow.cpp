@@ -6,18 +6,16 @@
 */
 #include "common.h"
 #include "originWindow.h"
-
-extern "C" pthread_mutex_t gMutex;
+#include "refreshscheduler.h"
 
 int originWindow::init(int width, int height)
 {
-    this->win_width = width;
-    this->win_height = height;
+    this->frame_width = width;
+    this->frame_height = height;
 
-    this->sdlRect.x = 0;
-    this->sdlRect.y = 0;
-    this->sdlRect.w = this->win_width;
-    this->sdlRect.h = this->win_height;
+    this->sdlRect = fitWindowRect(width, height);
+    this->win_width = this->sdlRect.w;
+    this->win_height = this->sdlRect.h;
 
     this->sdlWindow = SDL_CreateWindow(
         "Utopia Debug Window - Origin Window",
@@ -46,8 +44,8 @@ int originWindow::init(int width, int height)
         this->sdlRender,
         SDL_PIXELFORMAT_NV12,
 		SDL_TEXTUREACCESS_STREAMING,
-        this->win_width,
-        this->win_height);
+        this->frame_width,
+        this->frame_height);
     if (this->videoTexture == NULL)
     {
         SDL_Log("create video texture failed, error info: %s", SDL_GetError());
@@ -58,8 +56,8 @@ int originWindow::init(int width, int height)
         this->sdlRender,
         SDL_PIXELFORMAT_RGBA8888,
         SDL_TEXTUREACCESS_STREAMING,
-        this->win_width,
-        this->win_height);
+        this->frame_width,
+        this->frame_height);
     if (this->rulerTexture == NULL)
     {
         SDL_Log("create ruler texture failed, error info: %s", SDL_GetError());
@@ -72,8 +70,8 @@ int originWindow::init(int width, int height)
 		this->sdlRender,
 		SDL_PIXELFORMAT_RGBA8888,
 		SDL_TEXTUREACCESS_STREAMING,
-		this->win_width,
-		this->win_height);
+		this->frame_width,
+		this->frame_height);
 	if (this->faceTexture == NULL)
 	{
 		SDL_Log("create face texture failed, error info: %s", SDL_GetError());
@@ -85,8 +83,8 @@ int originWindow::init(int width, int height)
 		this->sdlRender,
 		SDL_PIXELFORMAT_RGBA8888,
 		SDL_TEXTUREACCESS_STREAMING,
-		this->win_width,
-		this->win_height);
+		this->frame_width,
+		this->frame_height);
 	if (this->audioTexture == NULL)
 	{
 		SDL_Log("create audio texture failed, error info: %s", SDL_GetError());
@@ -98,8 +96,8 @@ int originWindow::init(int width, int height)
 		this->sdlRender,
 		SDL_PIXELFORMAT_RGBA8888,
 		SDL_TEXTUREACCESS_STREAMING,
-		this->win_width,
-		this->win_height);
+		this->frame_width,
+		this->frame_height);
 	if (this->cropTexture == NULL)
 	{
 		SDL_Log("create crop texture failed, error info: %s", SDL_GetError());
@@ -113,6 +111,8 @@ int originWindow::init(int width, int height)
 
 int originWindow::handleEvent(
     SDL_Event event,
+    unsigned int dirtyLayers,
+    const SDL_Rect *dirtyRects,
     void *pVideoFrameBuffer,
     void *pRulerFrameBufferRGBA,
     void *pFaceFrameBuffer,
@@ -137,6 +137,8 @@ int originWindow::handleEvent(
     {
         // SDL_Log("REFRESH_EVENT");
         this->refreshWindow(
+            dirtyLayers,
+            dirtyRects,
             pVideoFrameBuffer,
             pRulerFrameBufferRGBA,
             pFaceFrameBuffer,
@@ -153,6 +155,8 @@ int originWindow::handleEvent(
 }
 
 int originWindow::refreshWindow(
+    unsigned int dirtyLayers,
+    const SDL_Rect *dirtyRects,
     void *pVideoFrameBuffer,
     void *pRulerFrameBufferRGBA,
     void *pFaceFrameBuffer,
@@ -162,25 +166,28 @@ int originWindow::refreshWindow(
 {
     SDL_RenderClear(this->sdlRender);
     // update video    
-    pthread_mutex_lock(&gMutex);
-    SDL_UpdateTexture(this->videoTexture, NULL, pVideoFrameBuffer, this->win_width);
-    pthread_mutex_unlock(&gMutex);
+    if (dirtyLayers & LAYER_VIDEO)
+        SDL_UpdateTexture(this->videoTexture, NULL, pVideoFrameBuffer, this->frame_width);
     SDL_RenderCopy(this->sdlRender, this->videoTexture, NULL, &this->sdlRect);
     
     // update ruler
-    SDL_UpdateTexture(this->rulerTexture, NULL, pRulerFrameBufferRGBA, this->win_width * 4);
+    if (dirtyLayers & LAYER_RULER)
+        refresh_update_texture(this->rulerTexture, (unsigned char *)pRulerFrameBufferRGBA, this->frame_width, this->frame_height, &dirtyRects[LAYER_RULER_INDEX]);
     SDL_RenderCopy(this->sdlRender, this->rulerTexture, NULL, &this->sdlRect);
 
     // update face
-    SDL_UpdateTexture(this->faceTexture, NULL, pFaceFrameBuffer, this->win_width * 4);
+    if (dirtyLayers & LAYER_FACE)
+        refresh_update_texture(this->faceTexture, (unsigned char *)pFaceFrameBuffer, this->frame_width, this->frame_height, &dirtyRects[LAYER_FACE_INDEX]);
     SDL_RenderCopy(this->sdlRender, this->faceTexture, NULL, &this->sdlRect);
 
     // update audio
-    SDL_UpdateTexture(this->audioTexture, NULL, pAudioFrameBuffer, this->win_width * 4);
+    if (dirtyLayers & LAYER_AUDIO)
+        refresh_update_texture(this->audioTexture, (unsigned char *)pAudioFrameBuffer, this->frame_width, this->frame_height, &dirtyRects[LAYER_AUDIO_INDEX]);
     SDL_RenderCopy(this->sdlRender, this->audioTexture, NULL, &this->sdlRect);
 
     // update crop
-	SDL_UpdateTexture(this->cropTexture, NULL, pCropFrameBuffer, this->win_width * 4);
+    if (dirtyLayers & LAYER_CROP)
+        refresh_update_texture(this->cropTexture, (unsigned char *)pCropFrameBuffer, this->frame_width, this->frame_height, &dirtyRects[LAYER_CROP_INDEX]);
     SDL_RenderCopy(this->sdlRender, this->cropTexture, NULL, &this->sdlRect);
 
     // show
@@ -11,7 +11,9 @@
 class originWindow
 {
 private:
-    int win_width;                      // width of origin window
+    int frame_width;                    // source frame, textures and layers
+    int frame_height;
+    int win_width;                      // width of origin window, frame scaled to fit
     int win_height;                     // height of origin window
 
     SDL_Window *sdlWindow;
@@ -26,6 +28,8 @@ private:
     SDL_Rect sdlRect;                  // display position of window
 
     int refreshWindow(
+        unsigned int dirtyLayers,
+        const SDL_Rect *dirtyRects,
         void *pVideoFrameBuffer,
         void *pRulerFrameBufferRGBA,
         void *pFaceFrameBuffer,
@@ -34,9 +38,11 @@ private:
     );                
 
 public:
-    int init(int width, int height);     // initialize origin window, create window & render
+    int init(int width, int height);     // initialize origin window for width x height frames, create window & render
     int handleEvent(
         SDL_Event event,
+        unsigned int dirtyLayers,            // LAYER_xxx to re-upload
+        const SDL_Rect *dirtyRects,          // changed area, indexed by LAYER_xxx_INDEX
         void *pVideoFrameBuffer,
         void *pRulerFrameBufferRGBA,
         void *pFaceFrameBuffer,
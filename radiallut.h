@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Radial Lookup Table
+ *
+ * Piecewise linear radius mapping of the lens, e.g. distorted radius to
+ * corrected radius. The points live in two contiguous sorted arrays and
+ * a uniform bucket table gives the segment of a radius directly, so a
+ * lookup is one index computation plus at most a short forward step,
+ * no tree walk and no cache missing node hop.
+ *
+ * Out of the table range the first/last segment is extrapolated.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _RADIAL_LUT_H_
+#define _RADIAL_LUT_H_
+
+#include <stdio.h>
+#include <vector>
+
+#define RADIAL_LUT_STEP 1.0F // pixels per bucket, below the smallest key gap
+#define RADIAL_LUT_MAX_BUCKETS (1 << 20) // a 4 MB table, radii of any real camera fit
+
+class RadialLut
+{
+public:
+    RadialLut()
+    {
+        inv_step = 1.0F;
+        last = 0;
+    }
+
+    virtual ~RadialLut()
+    {
+    }
+
+    /*
+     * keys: ascending radii, values: mapped radii, n >= 2 points
+     */
+    bool init(const float *key, const float *value, int n, float step = RADIAL_LUT_STEP)
+    {
+        int i, b;
+
+        if(NULL == key || NULL == value || n < 2 || step <= 0.0F)
+        {
+            printf("error: radial table needs 2 points at least, n=%d\n", n);
+            return false;
+        }
+        for(i = 1; i < n; i++)
+        {
+            if(!(key[i] > key[i-1]))
+            {
+                printf("error: radial table keys not ascending at %d\n", i);
+                return false;
+            }
+        }
+
+        if(!(key[n-1] * (1.0F / step) < RADIAL_LUT_MAX_BUCKETS)) // also inf and nan
+        {
+            printf("error: radial table radius %g needs more than %d buckets\n", key[n-1], RADIAL_LUT_MAX_BUCKETS);
+            return false;
+        }
+
+        keys.assign(key, key + n);
+        values.assign(value, value + n);
+        last = n - 2;
+        inv_step = 1.0F / step;
+
+        // segment of the first radius of every bucket, the last bucket
+        // also takes everything beyond the table
+        int count = (int)(keys[n-1] * inv_step) + 2;
+        buckets.resize(count);
+        for(b = 0, i = 0; b < count; b++)
+        {
+            while(i < last && keys[i+1] <= b * step)
+                i++;
+            buckets[b] = i;
+        }
+
+        return true;
+    }
+
+    bool IsEmpty() const
+    {
+        return keys.empty();
+    }
+
+    /*
+     * Mapped radius of r
+     */
+    float Map(float r) const
+    {
+        int b = (int)(r * inv_step);
+        if(b < 0)
+            b = 0;
+        else if(b >= (int)buckets.size())
+            b = buckets.size() - 1;
+
+        int k = buckets[b];
+        while(k < last && keys[k+1] <= r)
+            k++;
+        while(k > 0 && keys[k] > r) // rounding of r * inv_step
+            k--;
+
+        // same interpolation as the former map walk, tables come out identical
+        return (values[k+1] * (r - keys[k]) + values[k] * (keys[k+1] - r)) / (keys[k+1] - keys[k]);
+    }
+
+private:
+    std::vector<float> keys;
+    std::vector<float> values;
+    std::vector<int> buckets; // first segment of every bucket
+    float inv_step;
+    int last; // last segment
+};
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Radial Model
+ *
+ * Analytic radius mapping fitted to the lens samples, Brown-Conrady
+ * style rational form in r^2:
+ *
+ *     r' = r * (p0 + p1 t + ... + pn t^n) / (1 + q1 t + ... + qm t^m),  t = (r / norm)^2
+ *
+ * One model per direction, both fitted by weighted linear least squares
+ * on the same samples the table is made of, so evaluation is a few
+ * multiply-adds, no search, at any resolution.
+ *
+ * The rational form only holds inside the samples, it can reach a pole
+ * not far beyond them. Past the last sample the last segment is
+ * extrapolated, as RadialLut does, starting from the model at that edge.
+ *
+ * Same interface as RadialLut (init, Map), build with -D_RADIAL_MODEL_
+ * to use it as the radius lookup backend of DistortionPlayer.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _RADIAL_MODEL_H_
+#define _RADIAL_MODEL_H_
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm> // swap
+
+#define RADIAL_MODEL_NUM 5 // p0 .. p4
+#define RADIAL_MODEL_DEN 3 // q1 .. q3, higher orders start to grow poles
+#define RADIAL_MODEL_ITERATIONS 8 // reweighting passes, each one solves the linear system again
+
+class RadialModel
+{
+public:
+    RadialModel()
+    {
+        norm = 1.0;
+        edge = 0.0F;
+        edge_value = 0.0F;
+        edge_slope = 1.0F;
+        for(int i = 0; i < RADIAL_MODEL_NUM; i++)
+            p[i] = (i == 0) ? 1.0F : 0.0F;
+        for(int i = 0; i < RADIAL_MODEL_DEN; i++)
+            q[i] = 0.0F;
+        fitted = false;
+    }
+
+    virtual ~RadialModel()
+    {
+    }
+
+    /*
+     * Fit key -> value
+     *  keys: ascending radii, values: mapped radii, n points, more than the coefficients
+     */
+    bool init(const float *key, const float *value, int n)
+    {
+        const int M = RADIAL_MODEL_NUM + RADIAL_MODEL_DEN;
+        std::vector<double> weight(n, 1.0);
+        double c[M];
+        int i, it;
+
+        if(NULL == key || NULL == value || n <= M || key[n-1] <= 0.0F)
+        {
+            printf("error: radial model needs more than %d points, n=%d\n", M, n);
+            return false;
+        }
+
+        fitted = false; // Map below evaluates the model alone until the fit is done
+        norm = key[n-1];
+
+        // y*Q(t) = P(t) is linear in the coefficients, then reweight by
+        // r/Q so the residual is in pixels of the mapped radius
+        for(it = 0; it < RADIAL_MODEL_ITERATIONS; it++)
+        {
+            double ata[M][M + 1];
+            int row, col;
+
+            for(row = 0; row < M; row++)
+                for(col = 0; col <= M; col++)
+                    ata[row][col] = 0.0;
+
+            for(i = 0; i < n; i++)
+            {
+                double a[M];
+                double y;
+
+                if(key[i] <= 0.0F)
+                    continue; // the center says nothing about the ratio
+                y = (double)value[i] / key[i];
+                basis(key[i], y, a);
+                for(row = 0; row < M; row++)
+                {
+                    for(col = 0; col < M; col++)
+                        ata[row][col] += weight[i] * a[row] * a[col];
+                    ata[row][M] += weight[i] * a[row] * y;
+                }
+            }
+
+            if(!solve(ata, c))
+            {
+                printf("error: radial model fit is singular\n");
+                return false;
+            }
+            for(i = 0; i < RADIAL_MODEL_NUM; i++)
+                p[i] = c[i];
+            for(i = 0; i < RADIAL_MODEL_DEN; i++)
+                q[i] = c[RADIAL_MODEL_NUM + i];
+
+            for(i = 0; i < n; i++)
+            {
+                double den = denominator(key[i]);
+                weight[i] = (double)key[i] * key[i] / (den * den);
+            }
+        }
+
+        // a root of the denominator inside the range would be a pole
+        for(i = 0; i <= 1000; i++)
+        {
+            if(denominator(key[n-1] * i / 1000.0F) <= 0.0)
+            {
+                printf("error: radial model has a pole at r=%.1f\n", key[n-1] * i / 1000.0F);
+                return false;
+            }
+        }
+
+        // beyond the samples: the slope of the last segment, from the model at the edge
+        edge = key[n-1];
+        edge_value = Map(edge);
+        edge_slope = (value[n-1] - value[n-2]) / (key[n-1] - key[n-2]);
+
+        fitted = true;
+        return true;
+    }
+
+    bool IsEmpty() const
+    {
+        return !fitted;
+    }
+
+    /*
+     * Mapped radius of r
+     */
+    float Map(float r) const
+    {
+        double t = (double)r * r / (norm * norm);
+        double num = 0.0, den = 0.0;
+        int i;
+
+        if(fitted && r > edge)
+            return edge_value + (r - edge) * edge_slope;
+
+        for(i = RADIAL_MODEL_NUM - 1; i >= 0; i--)
+            num = num * t + p[i];
+        for(i = RADIAL_MODEL_DEN - 1; i >= 0; i--)
+            den = den * t + q[i];
+        return (float)(r * num / (1.0 + den * t));
+    }
+
+    /*
+     * Fit error against the samples and against the piecewise linear
+     * curve between them, in pixels of the mapped radius
+     */
+    void Report(const char *name, const float *key, const float *value, int n) const
+    {
+        double max_sample = 0.0, sum_sample = 0.0;
+        double max_curve = 0.0, sum_curve = 0.0;
+        float at = 0.0F;
+        int count = 0;
+        int i, k;
+
+        for(i = 0; i < n; i++)
+        {
+            double e = fabs(Map(key[i]) - value[i]);
+            sum_sample += e * e;
+            if(e > max_sample)
+            {
+                max_sample = e;
+                at = key[i];
+            }
+        }
+
+        for(i = 0; i + 1 < n; i++)
+        {
+            for(k = 1; k < 8; k++) // between the samples
+            {
+                float r = key[i] + (key[i+1] - key[i]) * k / 8;
+                float lin = (value[i+1] * (r - key[i]) + value[i] * (key[i+1] - r)) / (key[i+1] - key[i]);
+                double e = fabs(Map(r) - lin);
+                sum_curve += e * e;
+                max_curve = e > max_curve ? e : max_curve;
+                count++;
+            }
+        }
+
+        printf("info: radial model %s: samples max %.3f px at r=%.1f, rms %.3f px; "
+               "linear table max %.3f px, rms %.3f px\n",
+               name, max_sample, at, sqrt(sum_sample / n), max_curve, sqrt(sum_curve / (count ? count : 1)));
+    }
+
+private:
+    // row of the linear system: [1, t, t^2, .. | -y t, -y t^2, ..]
+    void basis(float r, double y, double *a) const
+    {
+        double t = (double)r * r / (norm * norm);
+        double tn = 1.0;
+        int i;
+
+        for(i = 0; i < RADIAL_MODEL_NUM; i++, tn *= t)
+            a[i] = tn;
+        for(tn = t, i = 0; i < RADIAL_MODEL_DEN; i++, tn *= t)
+            a[RADIAL_MODEL_NUM + i] = -y * tn;
+    }
+
+    double denominator(float r) const
+    {
+        double t = (double)r * r / (norm * norm);
+        double den = 0.0;
+
+        for(int i = RADIAL_MODEL_DEN - 1; i >= 0; i--)
+            den = den * t + q[i];
+        return 1.0 + den * t;
+    }
+
+    // gaussian elimination with partial pivoting on the augmented normal equations
+    template<int M>
+    static bool solve(double (&m)[M][M + 1], double *x)
+    {
+        int i, j, k;
+
+        for(i = 0; i < M; i++)
+        {
+            int pivot = i;
+            for(j = i + 1; j < M; j++)
+                if(fabs(m[j][i]) > fabs(m[pivot][i]))
+                    pivot = j;
+            if(fabs(m[pivot][i]) < 1e-300)
+                return false;
+            if(pivot != i)
+                for(k = 0; k <= M; k++)
+                    std::swap(m[i][k], m[pivot][k]);
+
+            for(j = i + 1; j < M; j++)
+            {
+                double f = m[j][i] / m[i][i];
+                for(k = i; k <= M; k++)
+                    m[j][k] -= f * m[i][k];
+            }
+        }
+
+        for(i = M - 1; i >= 0; i--)
+        {
+            double s = m[i][M];
+            for(j = i + 1; j < M; j++)
+                s -= m[i][j] * x[j];
+            x[i] = s / m[i][i];
+        }
+        return true;
+    }
+
+private:
+    double norm; // radius scale, keeps t in [0, 1]
+    float edge; // last sample, the model is not used beyond it
+    float edge_value;
+    float edge_slope;
+    double p[RADIAL_MODEL_NUM];
+    double q[RADIAL_MODEL_DEN];
+    bool fitted;
+};
+
+#endif
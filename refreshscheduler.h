@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Refresh Scheduler
+ *
+ * 1. Producers mark layers dirty from any thread, only the first mark
+ *     since the last redraw pushes an event, the rest ride along.
+ *
+ * 2. The event loop takes the dirty mask at redraw time, so a burst of
+ *     updates costs one redraw, and with a vsync'ed present at most one
+ *     per display frame.
+ *
+ * 3. Every layer keeps the union of the rectangles changed since the
+ *     last redraw, windows upload just that part.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _REFRESH_SCHEDULER_H_
+#define _REFRESH_SCHEDULER_H_
+
+#include <string.h> // memset
+#include <atomic>
+#include "SDL2/SDL.h"
+#include "autolock.h"
+
+#define REFRESH_MAX_LAYER 8 // dirty bit k is layer k
+
+class RefreshScheduler
+{
+public:
+    RefreshScheduler()
+    {
+        type = 0;
+        dirty.store(0);
+        pending.store(false);
+        memset(&full, 0, sizeof(full));
+        memset(rects, 0, sizeof(rects));
+    }
+
+    virtual ~RefreshScheduler()
+    {
+    }
+
+    /*
+     * Event type to push, layer size, and the layers the first redraw must upload
+     */
+    void init(Uint32 eventtype, int width, int height, unsigned int initial_dirty)
+    {
+        type = eventtype;
+        full.x = 0;
+        full.y = 0;
+        full.w = width;
+        full.h = height;
+        for(int k = 0; k < REFRESH_MAX_LAYER; k++)
+            rects[k] = (initial_dirty & (1u << k)) ? full : SDL_Rect();
+        dirty.store(initial_dirty); // no event, the first real mark pushes one
+        pending.store(false);
+    }
+
+    /*
+     * Mark layers dirty, pushes the event if none is queued
+     *  rect: changed area, NULL for the whole layer
+     */
+    void MarkDirty(unsigned int layers, const SDL_Rect *rect = NULL)
+    {
+        SDL_Rect area;
+
+        if(NULL == rect)
+            area = full;
+        else if(!SDL_IntersectRect(rect, &full, &area))
+            area.w = area.h = 0; // nothing visible changed, still redraw
+
+        rect_mtx.Lock();
+        for(int k = 0; k < REFRESH_MAX_LAYER; k++)
+        {
+            if(layers & (1u << k))
+                SDL_UnionRect(&rects[k], &area, &rects[k]);
+        }
+        dirty.fetch_or(layers);
+        rect_mtx.Unlock();
+
+        if(!pending.exchange(true))
+        {
+            SDL_Event event;
+            memset(&event, 0, sizeof(event));
+            event.type = type;
+            if(SDL_PushEvent(&event) != 1)
+                pending.store(false); // dropped, let the next mark try again
+        }
+    }
+
+    /*
+     * Take the dirty layers on the event loop, 0 if nothing changed
+     * re-arms the event first, a mark racing with us just adds a redraw
+     *  out: REFRESH_MAX_LAYER rects, changed area of every dirty layer
+     */
+    unsigned int TakeDirty(SDL_Rect *out)
+    {
+        unsigned int layers;
+
+        pending.store(false);
+
+        rect_mtx.Lock();
+        layers = dirty.exchange(0);
+        for(int k = 0; k < REFRESH_MAX_LAYER; k++)
+        {
+            out[k] = rects[k];
+            rects[k].x = rects[k].y = rects[k].w = rects[k].h = 0;
+        }
+        rect_mtx.Unlock();
+
+        return layers;
+    }
+
+private:
+    Uint32 type;
+    SDL_Rect full;
+    std::atomic<unsigned int> dirty;
+    std::atomic<bool> pending; // an event is queued and not taken yet
+
+    MutexLock rect_mtx; // protect rects
+    SDL_Rect rects[REFRESH_MAX_LAYER];
+};
+
+/*
+ * Upload the changed area of a 32-bit layer, a whole-layer rect goes as NULL
+ */
+inline int refresh_update_texture(SDL_Texture *texture, const unsigned char *pixels, int width, int height, const SDL_Rect *rect)
+{
+    if(SDL_RectEmpty(rect))
+        return 0;
+    if(rect->x == 0 && rect->y == 0 && rect->w == width && rect->h == height)
+        return SDL_UpdateTexture(texture, NULL, pixels, width * 4);
+    return SDL_UpdateTexture(texture, rect, pixels + ((size_t)rect->y * width + rect->x) * 4, width * 4);
+}
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Remap Cache
+ *
+ * Remap tables on disk, one file per table, named by a 64-bit key of
+ * everything the table is made of: lens calibration, radius lookup,
+ * entry layout, geometry and map type. A later launch maps the file
+ * read only instead of building the table again.
+ *
+ * File: RemapCacheHeader, then dst_w * dst_h RemapEntry as in memory.
+ * It is written under a temporary name and renamed, so a reader never
+ * sees half a file and two launches writing the same table do not clash.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _REMAP_CACHE_H_
+#define _REMAP_CACHE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h> // PATH_MAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "remaptable.h"
+
+#define REMAP_CACHE_MAGIC 0x50414d52 // "RMAP"
+#define REMAP_CACHE_VERSION 1
+#define REMAP_CACHE_MAX_FILES 16 // oldest ones go, e.g. after many calibration reloads
+#define REMAP_CACHE_PREFIX "remap_"
+
+struct RemapCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    int32_t src_w;
+    int32_t src_h;
+    int32_t dst_w;
+    int32_t dst_h;
+    int32_t maptype;
+    uint32_t entry_size; // sizeof(RemapEntry)
+    uint8_t reserved[24]; // entries start 64 bytes in
+};
+
+class RemapCache
+{
+public:
+    RemapCache()
+    {
+        dir[0] = '\0';
+    }
+
+    virtual ~RemapCache()
+    {
+    }
+
+    /*
+     * Directory of the cache files, created on the first store
+     *  NULL or "" turns the cache off
+     */
+    void SetDir(const char *path)
+    {
+        if(NULL == path || strlen(path) >= sizeof(dir))
+            dir[0] = '\0';
+        else
+            strcpy(dir, path);
+    }
+
+    bool IsEnabled() const
+    {
+        return dir[0] != '\0';
+    }
+
+    // FNV-1a, chained through h
+    static uint64_t Hash(const void *data, size_t len, uint64_t h = 0xcbf29ce484222325ULL)
+    {
+        const unsigned char *p = (const unsigned char *)data;
+
+        for(size_t i = 0; i < len; i++)
+        {
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    // key of one table of the lens with key lens
+    static uint64_t Key(uint64_t lens, int src_w, int src_h, int dst_w, int dst_h, int maptype)
+    {
+        int32_t geometry[7] = {src_w, src_h, dst_w, dst_h, maptype,
+                               (int32_t)sizeof(RemapEntry), REMAP_WEIGHT_BITS};
+
+        return Hash(geometry, sizeof(geometry), lens);
+    }
+
+    /*
+     * Map the table of key
+     *  returns:  NULL if there is no usable file, the caller builds it
+     */
+    RemapTable *Load(uint64_t key, int src_w, int src_h, int dst_w, int dst_h, int maptype)
+    {
+        char path[PATH_MAX];
+        struct stat st;
+        size_t size = sizeof(RemapCacheHeader) + (size_t)dst_w * dst_h * sizeof(RemapEntry);
+
+        if(!IsEnabled() || !file_path(path, sizeof(path), key))
+            return NULL;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            return NULL; // not cached yet
+
+        if(fstat(fd, &st) != 0 || (size_t)st.st_size != size)
+        {
+            printf("warning: remap cache %s has a wrong size, build again\n", path);
+            close(fd);
+            return NULL;
+        }
+
+        // the first frame reads every entry anyway, fault them in now
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED)
+        {
+            printf("warning: failed to map remap cache %s, errno=%d\n", path, errno);
+            return NULL;
+        }
+
+        const RemapCacheHeader *h = (const RemapCacheHeader *)map;
+        if(h->magic != REMAP_CACHE_MAGIC || h->version != REMAP_CACHE_VERSION || h->key != key ||
+           h->src_w != src_w || h->src_h != src_h || h->dst_w != dst_w || h->dst_h != dst_h ||
+           h->maptype != maptype || h->entry_size != sizeof(RemapEntry) ||
+           !check_entries((const RemapEntry *)(h + 1), src_w, src_h, dst_w * dst_h))
+        {
+            printf("warning: remap cache %s does not match, build again\n", path);
+            munmap(map, size);
+            return NULL;
+        }
+
+        return new RemapTable(src_w, src_h, dst_w, dst_h, maptype, map, size, sizeof(RemapCacheHeader));
+    }
+
+    /*
+     * Write the table of key, a failure only costs the next launch a build
+     */
+    bool Store(uint64_t key, const RemapTable &table)
+    {
+        char path[PATH_MAX];
+        char tmp[PATH_MAX];
+        RemapCacheHeader h;
+        bool ok;
+
+        if(!IsEnabled() || !file_path(path, sizeof(path), key) ||
+           snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp))
+            return false;
+
+        if(!make_dir())
+        {
+            printf("warning: failed to create remap cache %s, errno=%d\n", dir, errno);
+            return false;
+        }
+
+        FILE *fp = fopen(tmp, "wb");
+        if(NULL == fp)
+        {
+            printf("warning: failed to write remap cache %s, errno=%d\n", tmp, errno);
+            return false;
+        }
+
+        memset(&h, 0, sizeof(h));
+        h.magic = REMAP_CACHE_MAGIC;
+        h.version = REMAP_CACHE_VERSION;
+        h.key = key;
+        h.src_w = table.src_w;
+        h.src_h = table.src_h;
+        h.dst_w = table.dst_w;
+        h.dst_h = table.dst_h;
+        h.maptype = table.maptype;
+        h.entry_size = sizeof(RemapEntry);
+
+        ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+             fwrite(table.entries, sizeof(RemapEntry), table.GetCount(), fp) == (size_t)table.GetCount();
+        ok = (fclose(fp) == 0) && ok;
+
+        if(!ok || rename(tmp, path) != 0)
+        {
+            printf("warning: failed to write remap cache %s, errno=%d\n", path, errno);
+            unlink(tmp);
+            return false;
+        }
+
+        prune();
+        return true;
+    }
+
+private:
+    bool file_path(char *path, size_t len, uint64_t key) const
+    {
+        return snprintf(path, len, "%s/" REMAP_CACHE_PREFIX "%016llx.bin", dir, (unsigned long long)key) < (int)len;
+    }
+
+    // mkdir -p
+    bool make_dir() const
+    {
+        char path[PATH_MAX];
+
+        strcpy(path, dir);
+        for(char *p = path + 1; ; p++)
+        {
+            if(*p != '/' && *p != '\0')
+                continue;
+
+            char c = *p;
+            *p = '\0';
+            if(mkdir(path, 0755) != 0 && errno != EEXIST)
+                return false;
+            if(c == '\0')
+                return true;
+            *p = c;
+        }
+    }
+
+    // a damaged file must not send the gather out of the source image
+    static bool check_entries(const RemapEntry *e, int src_w, int src_h, int count)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            if(e[i].x > src_w - 2 || e[i].y > src_h - 2 ||
+               e[i].w01 + e[i].w10 + e[i].w11 > REMAP_WEIGHT_ONE)
+                return false;
+        }
+        return true;
+    }
+
+    // keep the newest REMAP_CACHE_MAX_FILES tables
+    void prune() const
+    {
+        std::vector<std::pair<time_t, std::vector<char> > > files;
+        char path[PATH_MAX];
+        struct dirent *ent;
+        struct stat st;
+
+        DIR *d = opendir(dir);
+        if(NULL == d)
+            return;
+
+        while((ent = readdir(d)) != NULL)
+        {
+            size_t len = strlen(ent->d_name);
+            if(strncmp(ent->d_name, REMAP_CACHE_PREFIX, strlen(REMAP_CACHE_PREFIX)) != 0 ||
+               len < 4 || strcmp(ent->d_name + len - 4, ".bin") != 0 || // not a file being written
+               snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name) >= (int)sizeof(path) ||
+               stat(path, &st) != 0)
+                continue;
+            files.push_back(std::make_pair(st.st_mtime, std::vector<char>(path, path + strlen(path) + 1)));
+        }
+        closedir(d);
+
+        if(files.size() <= REMAP_CACHE_MAX_FILES)
+            return;
+
+        std::sort(files.begin(), files.end());
+        for(size_t i = 0; i + REMAP_CACHE_MAX_FILES < files.size(); i++)
+            unlink(&files[i].second[0]); // a mapped file stays readable until unmapped
+    }
+
+private:
+    char dir[PATH_MAX];
+};
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Remap Table
+ *
+ * Destination-to-source coordinate table of a distortion correction.
+ * The geometry does not change from frame to frame, so the table is
+ * built once per (src size, dst size, map type) and every later frame
+ * is only a gather through it.
+ *
+ * Every entry keeps the left-top source pixel of a bilinear 2x2 block
+ * plus fixed-point weights, so the gather is integer only and branch
+ * free. A weight takes 9 bits, 0 to 256, so a sample on the far row or
+ * column of the block gets all of it. Sources smaller than 2x2 have no
+ * block and are rejected by the callers.
+ *
+ * The entries are either built in memory or mapped from a cache file
+ * (see remapcache.h), the gather does not tell them apart.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _REMAP_TABLE_H_
+#define _REMAP_TABLE_H_
+
+#include <vector>
+#include <string.h> // memset
+#include <sys/mman.h> // munmap
+
+#define REMAP_WEIGHT_BITS 8
+#define REMAP_WEIGHT_ONE (1 << REMAP_WEIGHT_BITS) // weights of a block sum up to this
+
+struct RemapEntry
+{
+    unsigned short x; // left-top pixel of the 2x2 source block
+    unsigned short y;
+    unsigned short w01; // weight of right-top pixel
+    unsigned short w10; // weight of left-bottom pixel
+    unsigned short w11; // weight of right-bottom pixel
+    unsigned char mask; // 0xff if there is a source pixel, 0 to leave black
+};
+
+class RemapTable
+{
+public:
+    RemapTable(int srcw, int srch, int dstw, int dsth, int type)
+    {
+        src_w = srcw;
+        src_h = srch;
+        dst_w = dstw;
+        dst_h = dsth;
+        maptype = type;
+        storage.resize(dst_w * dst_h);
+        memset(&storage[0], 0, storage.size() * sizeof(RemapEntry));
+        entries = &storage[0];
+        mapped = NULL;
+        mapsize = 0;
+    }
+
+    /*
+     * Entries at offset of a mapping of size bytes, read only,
+     * unmapped with the table
+     */
+    RemapTable(int srcw, int srch, int dstw, int dsth, int type, void *map, size_t size, size_t offset)
+    {
+        src_w = srcw;
+        src_h = srch;
+        dst_w = dstw;
+        dst_h = dsth;
+        maptype = type;
+        entries = (RemapEntry *)((unsigned char *)map + offset);
+        mapped = map;
+        mapsize = size;
+    }
+
+    virtual ~RemapTable()
+    {
+        if(mapped != NULL)
+            munmap(mapped, mapsize);
+    }
+
+    // entries points into storage or the mapping, which is unmapped once
+    RemapTable(const RemapTable &) = delete;
+    RemapTable &operator=(const RemapTable &) = delete;
+
+    int GetCount() const
+    {
+        return dst_w * dst_h;
+    }
+
+    bool Match(int srcw, int srch, int dstw, int dsth, int type) const
+    {
+        return src_w == srcw && src_h == srch && dst_w == dstw && dst_h == dsth && maptype == type;
+    }
+
+    RemapEntry &At(int x, int y)
+    {
+        return entries[y * dst_w + x];
+    }
+
+    /*
+     * Map destination pixel (dx, dy) to source coordinate (sx, sy)
+     * sx, sy are left-top based, out of [0, src_w] x [0, src_h] leaves it black
+     */
+    void Set(int dx, int dy, float sx, float sy)
+    {
+        if(src_w < 2 || src_h < 2 || sx < 0 || sx > src_w || sy < 0 || sy > src_h)
+            return; // no 2x2 block or out of range
+
+        int x1 = (int)sx;
+        int y1 = (int)sy;
+
+        // keep the 2x2 block inside the image
+        if(x1 > src_w - 2)
+            x1 = src_w - 2;
+        if(y1 > src_h - 2)
+            y1 = src_h - 2;
+
+        float fx = sx - x1;
+        float fy = sy - y1;
+        if(fx > 1.0F)
+            fx = 1.0F;
+        if(fy > 1.0F)
+            fy = 1.0F;
+
+        int w01 = (int)(fx * (1.0F - fy) * REMAP_WEIGHT_ONE + 0.5F);
+        int w10 = (int)((1.0F - fx) * fy * REMAP_WEIGHT_ONE + 0.5F);
+        int w11 = (int)(fx * fy * REMAP_WEIGHT_ONE + 0.5F);
+        // rounding must not push the left-top weight below zero
+        if(w01 + w10 + w11 > REMAP_WEIGHT_ONE)
+        {
+            w11 = REMAP_WEIGHT_ONE - w01 - w10;
+            if(w11 < 0)
+            {
+                w10 += w11;
+                w11 = 0;
+            }
+        }
+
+        RemapEntry &e = At(dx, dy);
+        e.x = (unsigned short)x1;
+        e.y = (unsigned short)y1;
+        e.w01 = (unsigned short)w01;
+        e.w10 = (unsigned short)w10;
+        e.w11 = (unsigned short)w11;
+        e.mask = 0xff;
+    }
+
+public:
+    int src_w;
+    int src_h;
+    int dst_w;
+    int dst_h;
+    int maptype;
+    RemapEntry *entries; // dst_w * dst_h, row by row
+
+private:
+    std::vector<RemapEntry> storage; // built in memory
+    void *mapped; // or mapped from a file
+    size_t mapsize;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Ruler Grid
+ *
+ * The debug ruler is a straight grid seen through the distortion: one
+ * pixel lines every xspacing/yspacing pixels from the image center plus
+ * a small center mark. It only depends on the image size and the
+ * spacing, so it is built once per (size, spacing) and kept as runs of
+ * lit pixels of every row, drawing it is a few thousand span writes.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _RULER_GRID_H_
+#define _RULER_GRID_H_
+
+#include <vector>
+#include <string.h> // memset
+
+#define RULER_ALPHA 0x80
+#define RULER_THRESHOLD 0x40 // dimmer pixels of a warped line are left out
+#define RULER_MARK_SIZE 4 // half size of the center mark
+
+struct RulerSpan
+{
+    unsigned short y;
+    unsigned short x;
+    unsigned short len;
+    unsigned int value; // first intensity of the span in RulerGrid::values
+};
+
+class RulerGrid
+{
+public:
+    RulerGrid(int w, int h, int xspace, int yspace)
+    {
+        width = w;
+        height = h;
+        xspacing = xspace;
+        yspacing = yspace;
+    }
+
+    virtual ~RulerGrid()
+    {
+    }
+
+    bool Match(int w, int h, int xspace, int yspace) const
+    {
+        return width == w && height == h && xspacing == xspace && yspacing == yspace;
+    }
+
+    /*
+     * Pixel of the straight grid, before distortion
+     */
+    bool IsLine(int x, int y) const
+    {
+        int cx = width / 2 - 1;
+        int cy = height / 2 - 1;
+
+        if(((x - cx) % xspacing) == 0 || ((y - cy) % yspacing) == 0)
+            return true;
+        return x >= width / 2 - RULER_MARK_SIZE && x < width / 2 + RULER_MARK_SIZE &&
+               y >= height / 2 - RULER_MARK_SIZE && y < height / 2 + RULER_MARK_SIZE;
+    }
+
+    /*
+     * Append a run of lit pixels of row y
+     */
+    void AddSpan(int y, int x, const unsigned char *intensity, int len)
+    {
+        RulerSpan span;
+
+        span.y = (unsigned short)y;
+        span.x = (unsigned short)x;
+        span.len = (unsigned short)len;
+        span.value = values.size();
+        values.insert(values.end(), intensity, intensity + len);
+        spans.push_back(span);
+    }
+
+    /*
+     * Write the spans into a width x height RGBA8888 layer (bytes A, B, G, R),
+     * magenta at the intensity the line got through the warp
+     */
+    void Draw(unsigned char *rgba) const
+    {
+        for(size_t k = 0; k < spans.size(); k++)
+        {
+            const RulerSpan &s = spans[k];
+            const unsigned char *v = &values[s.value];
+            unsigned char *p = rgba + ((size_t)s.y * width + s.x) * 4;
+
+            for(int i = 0; i < s.len; i++, p += 4)
+            {
+                p[0] = RULER_ALPHA;
+                p[1] = v[i];
+                p[2] = 0x00;
+                p[3] = v[i];
+            }
+        }
+    }
+
+    // clear what Draw() wrote
+    void Clear(unsigned char *rgba) const
+    {
+        for(size_t k = 0; k < spans.size(); k++)
+            memset(rgba + ((size_t)spans[k].y * width + spans[k].x) * 4, 0, spans[k].len * 4);
+    }
+
+public:
+    int width;
+    int height;
+    int xspacing;
+    int yspacing;
+    std::vector<RulerSpan> spans; // row by row, left to right
+    std::vector<unsigned char> values;
+};
+
+#endif
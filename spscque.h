@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Single Producer Single Consumer Circle Queue
+ *
+ * 1. The same two-phase surface interface as MyCircleQue
+ *     (GetEnqueSurface/Enque, GetDequeSurface/Deque).
+ *
+ * 2. Lock free: the producer only writes tail, the consumer only writes
+ *     head, published with release and read with acquire ordering.
+ *     Enque side must stay on one thread, Deque side on another one.
+ *
+ * 3. Blocking waits for the other side, the mutex is only touched when
+ *     somebody is sleeping.
+ *
+ * 4. Every surface carries an int tag of the producer from Enque() to
+ *     the consumer, e.g. the pixel format it was filled with.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _SPSC_QUE_H_
+#define _SPSC_QUE_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <sys/time.h> // gettimeofday
+
+#define CACHE_LINE_SIZE 64
+
+class SpscCircleQue
+{
+public:
+    SpscCircleQue(int maxque, int bufsize)
+    {
+        capacity = maxque;
+        buffers.resize(maxque, std::vector<unsigned char>(bufsize)); // a[M][N]
+        tags.resize(maxque, 0);
+        head.store(0);
+        tail.store(0);
+        waiters.store(0);
+        wakeup.store(0);
+        pthread_mutex_init(&wait_mtx, NULL);
+        pthread_cond_init(&not_empty, NULL);
+        pthread_cond_init(&not_full, NULL);
+    }
+
+    virtual ~SpscCircleQue()
+    {
+        pthread_mutex_destroy(&wait_mtx);
+        pthread_cond_destroy(&not_empty);
+        pthread_cond_destroy(&not_full);
+    }
+
+    bool IsEmpty()
+    {
+        return GetSize() == 0;
+    }
+
+    bool IsFull()
+    {
+        return GetSize() == capacity;
+    }
+
+    int GetSize()
+    {
+        return (int)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+
+    // producer side
+
+    unsigned char *GetEnqueSurface()
+    {
+        unsigned long long t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == (unsigned long long)capacity)
+            return NULL; // full
+        return &buffers[t % capacity][0];
+    }
+
+    bool Enque(unsigned char *surface, int tag = 0)
+    {
+        unsigned long long t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == (unsigned long long)capacity)
+        {
+            printf("error: full queue! capacity=%d\n", capacity);
+            return false;
+        }
+        if(surface != &buffers[t % capacity][0])
+        {
+            printf("error: bad enque surface!\n");
+            return false;
+        }
+
+        tags[t % capacity] = tag;
+        tail.store(t + 1, std::memory_order_release); // publish surface and tag
+        notify(&not_empty);
+        return true;
+    }
+
+    /*
+     * Wait until a surface is free
+     *  timeout_ms: < 0 wait forever
+     *  returns NULL on timeout or Wakeup()
+     */
+    unsigned char *WaitEnqueSurface(int timeout_ms)
+    {
+        unsigned char *surface = GetEnqueSurface();
+        if(surface == NULL && wait(&not_full, false, timeout_ms))
+            surface = GetEnqueSurface();
+        return surface;
+    }
+
+    // consumer side
+
+    unsigned char *GetDequeSurface()
+    {
+        unsigned long long h = head.load(std::memory_order_relaxed);
+        if(tail.load(std::memory_order_acquire) == h)
+            return NULL; // empty
+        return &buffers[h % capacity][0];
+    }
+
+    // tag of the surface GetDequeSurface() returns, call after it succeeded
+    int GetDequeTag()
+    {
+        return tags[head.load(std::memory_order_relaxed) % capacity];
+    }
+
+    unsigned char *Deque()
+    {
+        unsigned long long h = head.load(std::memory_order_relaxed);
+        if(tail.load(std::memory_order_acquire) == h)
+        {
+            printf("error: empty queue! capacity=%d\n", capacity);
+            return NULL;
+        }
+
+        unsigned char *buf = &buffers[h % capacity][0];
+        head.store(h + 1, std::memory_order_release); // give surface back
+        notify(&not_full);
+        return buf;
+    }
+
+    /*
+     * Wait until a surface is filled
+     *  timeout_ms: < 0 wait forever
+     *  returns NULL on timeout or Wakeup()
+     */
+    unsigned char *WaitDequeSurface(int timeout_ms)
+    {
+        unsigned char *surface = GetDequeSurface();
+        if(surface == NULL && wait(&not_empty, true, timeout_ms))
+            surface = GetDequeSurface();
+        return surface;
+    }
+
+    /*
+     * Release all waiting threads, e.g. before stopping them
+     */
+    void Wakeup()
+    {
+        pthread_mutex_lock(&wait_mtx);
+        wakeup.fetch_add(1);
+        pthread_cond_broadcast(&not_empty);
+        pthread_cond_broadcast(&not_full);
+        pthread_mutex_unlock(&wait_mtx);
+    }
+
+private:
+    void notify(pthread_cond_t *cond)
+    {
+        // pairs with the fetch_add in wait(): either the waiter sees
+        // the new index or we see the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters.load(std::memory_order_relaxed) > 0)
+        {
+            pthread_mutex_lock(&wait_mtx);
+            pthread_cond_broadcast(cond);
+            pthread_mutex_unlock(&wait_mtx);
+        }
+    }
+
+    bool wait(pthread_cond_t *cond, bool for_data, int timeout_ms)
+    {
+        struct timespec ts;
+        struct timeval cur;
+        int ret = 0;
+
+        if(timeout_ms >= 0)
+        {
+            gettimeofday(&cur, NULL);
+            long nsec = cur.tv_usec * 1000L + (timeout_ms % 1000) * 1000000L;
+            ts.tv_sec = cur.tv_sec + timeout_ms / 1000 + nsec / 1000000000L;
+            ts.tv_nsec = nsec % 1000000000L;
+        }
+
+        waiters.fetch_add(1); // seq_cst
+        pthread_mutex_lock(&wait_mtx);
+        unsigned int woken = wakeup.load();
+        while(ret == 0 && woken == wakeup.load() &&
+              (for_data ? GetDequeSurface() == NULL : GetEnqueSurface() == NULL))
+        {
+            if(timeout_ms >= 0)
+                ret = pthread_cond_timedwait(cond, &wait_mtx, &ts);
+            else
+                ret = pthread_cond_wait(cond, &wait_mtx);
+        }
+        pthread_mutex_unlock(&wait_mtx);
+        waiters.fetch_sub(1);
+
+        return ret == 0;
+    }
+
+private:
+    // indexes keep counting (64 bits never wrap), slot = index % capacity
+    // a queue inside a heap object relies on C++17 aligned new for these
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned long long> head; // written by consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned long long> tail; // written by producer
+    alignas(CACHE_LINE_SIZE) std::atomic<int> waiters; // threads sleeping in wait()
+    std::atomic<unsigned int> wakeup; // bumped by Wakeup()
+
+    int capacity;
+    std::vector<std::vector<unsigned char> > buffers;
+    std::vector<int> tags; // of the surface in the same slot
+
+    pthread_mutex_t wait_mtx; // only for sleeping
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+#endif
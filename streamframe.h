@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Stream Frame
+ *
+ * Framing of the uvd streams: every message is a fixed header followed
+ * by length payload bytes. The magic lets a receiver find the next
+ * message again after a glitch, the sequence number tells it what was
+ * dropped and the capture timestamp how late a frame is.
+ *
+ * Header, 32 bytes, little endian like the payloads:
+ *
+ *     u32 magic "UVDF", u16 version (1), u16 header size (32),
+ *     u32 payload length, u32 sequence (per stream, +1 every message),
+ *     u64 capture time (microseconds of CLOCK_REALTIME, 0 if unknown),
+ *     u32 payload format, u16 width, u16 height (0 if not an image)
+ *
+ * A zero length message is a heartbeat: nothing new up to its timestamp,
+ * e.g. for a metadata stream that only sends changes.
+ * Legacy raw streams have no header, every message is msgsize bytes.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _STREAM_FRAME_H_
+#define _STREAM_FRAME_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define STREAM_FRAME_MAGIC 0x46445655 // "UVDF"
+#define STREAM_FRAME_VERSION 1
+
+// payload formats
+#define STREAM_FORMAT_RAW 0 // struct of the stream, e.g. FaceFrame
+#define STREAM_FORMAT_NV12 1 // width x height Y plane, then interleaved UV
+#define STREAM_FORMAT_JPEG 2 // a width x height JPEG image
+
+struct StreamFrameHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t length; // payload bytes
+    uint32_t sequence;
+    uint64_t timestamp; // capture time, microseconds
+    uint32_t format;
+    uint16_t width;
+    uint16_t height;
+};
+
+// microseconds of CLOCK_REALTIME, sender and receiver are expected to be NTP synced
+inline uint64_t StreamFrameClock()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// header of a message the sender is about to write
+inline void InitStreamFrame(StreamFrameHeader *hdr, uint32_t sequence, uint32_t format,
+                            int width, int height, uint32_t length)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = STREAM_FRAME_MAGIC;
+    hdr->version = STREAM_FRAME_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->length = length;
+    hdr->sequence = sequence;
+    hdr->timestamp = StreamFrameClock();
+    hdr->format = format;
+    hdr->width = width;
+    hdr->height = height;
+}
+
+#endif
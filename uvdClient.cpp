@@ -1,477 +1,873 @@
 
+#include <algorithm>
 #include "uvdClient.h"
 
-pthread_mutex_t gMutex;
 DistortionPlayer gDistortionPlayer;
 
-int uvdClient::getVideoFrameThread(void *para)
+// capture time of a framed message, the arrival if the sender does not know it
+static uint64_t captureTime(const StreamFrameHeader *hdr)
+{
+    return hdr->timestamp != 0 ? hdr->timestamp : StreamFrameClock();
+}
+
+unsigned char *uvdClient::getVideoBuffer(void *para)
 {
     uvdClient *pUvdClient = (uvdClient *)para;
-    
-    struct sockaddr_in video_address;
-    int video_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    video_address.sin_family = AF_INET;
-    video_address.sin_addr.s_addr = inet_addr(pUvdClient->serverIP);
-    video_address.sin_port = htons(VIDEO_PORT);
 
-    SDL_Event event;
+    // JPEG: a free packet, NULL while every decoder is behind
+    if (pUvdClient->videoFormat == STREAM_FORMAT_JPEG)
+        return pUvdClient->videoDecoder.GetPacket();
+
+    // receive straight into a free ring slot, renderers never see it half written
+    return pUvdClient->videoFrameRing.GetWriteSlot();
+}
+
+void uvdClient::onVideoFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr)
+{
+    uvdClient *pUvdClient = (uvdClient *)para;
+    const FrameGeometry &g = pUvdClient->geometry;
 
-    if (connect(video_sockfd, (struct sockaddr *)&video_address, sizeof(sockaddr_in)) == -1)
+    if (size == 0)
+        return; // heartbeat, every frame has a timestamp of its own
+
+    // buffers are sized by -v, another frame is not shown and its slot is received into again
+    if ((pUvdClient->videoFormat == STREAM_FORMAT_NV12 && size != g.sizeNV12()) ||
+        (pUvdClient->streamMode == STREAM_FRAMED &&
+         (hdr->format != (uint32_t)pUvdClient->videoFormat || hdr->width != g.width || hdr->height != g.height)))
     {
-        SDL_Log("video socket connect error.");
-        event.type = SDL_QUIT;
-        SDL_PushEvent(&event);
-        return -1;
+        if (pUvdClient->badVideoFrames++ == 0)
+            SDL_Log("video frame %ux%u format %u, %d bytes, expect %s %dx%d (-v/-c), dropped.",
+                    hdr->width, hdr->height, hdr->format, size,
+                    pUvdClient->videoFormat == STREAM_FORMAT_JPEG ? "JPEG" : "NV12", g.width, g.height);
+        if (pUvdClient->videoFormat == STREAM_FORMAT_JPEG)
+            pUvdClient->videoDecoder.Release(msg);
+        return;
+    }
+
+    if (pUvdClient->videoFormat == STREAM_FORMAT_JPEG)
+    {
+        // published by onVideoDecoded
+        pUvdClient->videoDecoder.Submit(msg, size, hdr->sequence, captureTime(hdr));
+    }
+    else if (pUvdClient->syncBudget > 0)
+    {
+        Autolock lock(&pUvdClient->syncLock);
+        pUvdClient->holdVideoFrame(msg, captureTime(hdr));
+        pUvdClient->releaseVideoFrames();
     }
     else
     {
-        SDL_Log("video socket connect success.");
+        pUvdClient->videoFrameRing.Publish(msg);
+        pUvdClient->refreshScheduler.MarkDirty(LAYER_VIDEO);
     }
 
-    while(1)
+    StreamStats stats;
+    if (pUvdClient->streamMode == STREAM_FRAMED && hdr->sequence % VIDEO_STATS_INTERVAL == 0 &&
+        pUvdClient->netReactor.TakeStats(pUvdClient->videoStream, &stats))
     {
-        if (recv(video_sockfd, (char *)pUvdClient->pVideoFrameBufferTemp, VIDEO_FRAME_SIZE_NV12, MSG_WAITALL) == VIDEO_FRAME_SIZE_NV12)
+        SDL_Log("video: %u frames, %u dropped, %u resyncs, %u bad, latency avg %.1f ms max %.1f ms.",
+                stats.messages, stats.dropped, stats.resyncs, pUvdClient->badVideoFrames,
+                stats.latency_count ? stats.latency_sum / 1000.0 / stats.latency_count : 0.0,
+                stats.latency_max / 1000.0);
+
+        if (pUvdClient->videoFormat == STREAM_FORMAT_JPEG)
         {
-            pthread_mutex_lock(&gMutex);
-            memcpy(pUvdClient->pVideoFrameBuffer, pUvdClient->pVideoFrameBufferTemp, VIDEO_FRAME_SIZE_NV12);
-            pthread_mutex_unlock(&gMutex);
-            event.type = REFRESH_EVENT;
-            SDL_PushEvent(&event);
+            unsigned int decoded, late, failed;
+            pUvdClient->videoDecoder.GetStats(&decoded, &late, &failed);
+            SDL_Log("video: %u decoded, %u late, %u failed, %u not received (decoders busy).",
+                    decoded, late, failed, stats.discarded);
         }
-        else
+
+        if (pUvdClient->syncBudget > 0)
         {
-            SDL_Log("video socket, do not receive enough bytes, error.");
-            event.type = SDL_QUIT;
-            SDL_PushEvent(&event);
-            break;
+            Autolock lock(&pUvdClient->syncLock);
+            SDL_Log("sync: %u frames late, %d held, metadata overflows face %u audio %u crop %u.",
+                    pUvdClient->lateFrames, (int)pUvdClient->heldFrames.size(), pUvdClient->faceJitter.GetOverflows(),
+                    pUvdClient->audioJitter.GetOverflows(), pUvdClient->cropJitter.GetOverflows());
         }
     }
+}
 
-    return 0;
+/*
+ * A decoded JPEG frame, on a decoder thread, one at a time
+ */
+void uvdClient::onVideoDecoded(void *para, const unsigned char *nv12, uint32_t sequence, uint64_t timestamp)
+{
+    uvdClient *pUvdClient = (uvdClient *)para;
+
+    if (pUvdClient->syncBudget > 0)
+    {
+        // the network thread releases held slots too
+        Autolock lock(&pUvdClient->syncLock);
+        unsigned char *slot = pUvdClient->videoFrameRing.GetWriteSlot();
+
+        memcpy(slot, nv12, pUvdClient->geometry.sizeNV12());
+        pUvdClient->holdVideoFrame(slot, timestamp);
+        pUvdClient->releaseVideoFrames();
+        return;
+    }
+
+    unsigned char *slot = pUvdClient->videoFrameRing.GetWriteSlot();
+
+    memcpy(slot, nv12, pUvdClient->geometry.sizeNV12());
+    pUvdClient->videoFrameRing.Publish(slot);
+    pUvdClient->refreshScheduler.MarkDirty(LAYER_VIDEO);
 }
 
-int uvdClient::drawCropFrame()
+/*
+ * Keep a written video slot until the metadata of timestamp is in
+ */
+void uvdClient::holdVideoFrame(unsigned char *slot, uint64_t timestamp)
 {
-    int left, top, right, bottom;
-    memset(this->pCropFrameBuffer, 0x00, VIDEO_FRAME_SIZE_RGBA);
-    
-    if (this->cropPosition[3] != 0)
+    HeldFrame frame;
+
+    frame.slot = slot;
+    frame.timestamp = timestamp;
+    frame.held = SDL_GetTicks();
+    this->videoFrameRing.Hold(slot);
+    this->heldFrames.push_back(frame);
+}
+
+/*
+ * Show held frames, oldest first, each with the face, audio and crop in
+ * effect at its capture time. A frame goes once every metadata stream
+ * has reached its time, or after syncBudget ms, or when the hold is full,
+ * the last two count as late and show whatever is in.
+ */
+void uvdClient::releaseVideoFrames()
+{
+    Uint32 now = SDL_GetTicks();
+    unsigned int dirtyLayers = 0;
+    SDL_Rect faceChanged = {0, 0, 0, 0};
+    SDL_Rect audioChanged = {0, 0, 0, 0};
+    SDL_Rect cropChanged = {0, 0, 0, 0};
+    SDL_Rect changed;
+
+    while (!this->heldFrames.empty())
     {
-        left = this->cropPosition[0];
-        top = this->cropPosition[1];
-        right = this->cropPosition[2];
-        bottom = this->cropPosition[3];
+        const HeldFrame &frame = this->heldFrames.front();
 
-        for (int j = top; j < bottom; j++)
+        if (!this->faceJitter.Covers(frame.timestamp) || !this->audioJitter.Covers(frame.timestamp) ||
+            !this->cropJitter.Covers(frame.timestamp))
         {
-            for (int k = left; k < right; k++)
-            {
-                if (k - left < 4 || right - k < 4 || j - top < 4 || bottom - j < 4)
-                {
-                    this->pCropFrameBuffer[(j * PIXEL_W + k) * 4 + 0] = 0xff;
-                    this->pCropFrameBuffer[(j * PIXEL_W + k) * 4 + 1] = 0xff;
-                    this->pCropFrameBuffer[(j * PIXEL_W + k) * 4 + 2] = 0x00;
-                    this->pCropFrameBuffer[(j * PIXEL_W + k) * 4 + 3] = 0x00;
-                }
-            }
+            if (now - frame.held < (Uint32)this->syncBudget && this->heldFrames.size() < SYNC_MAX_FRAMES)
+                break;
+            this->lateFrames++;
         }
+
+        // overlays of this time first, NULL if the one shown is still in effect,
+        // a refresh in between would show them over the previous frame
+        this->publishSequence.fetch_add(1);
+        const FaceFrame *face = this->faceJitter.Match(frame.timestamp);
+        if (face != NULL)
+        {
+            this->drawFaceFrame(face, &changed);
+            SDL_UnionRect(&faceChanged, &changed, &faceChanged);
+            dirtyLayers |= LAYER_FACE;
+        }
+
+        const int *audio = this->audioJitter.Match(frame.timestamp);
+        if (audio != NULL)
+        {
+            this->drawAudioFrame(*audio, &changed);
+            SDL_UnionRect(&audioChanged, &changed, &audioChanged);
+            dirtyLayers |= LAYER_AUDIO;
+        }
+
+        const CropShape *crop = this->cropJitter.Match(frame.timestamp);
+        if (crop != NULL)
+        {
+            this->drawCropFrame(crop->position, &changed);
+            SDL_UnionRect(&cropChanged, &changed, &cropChanged);
+            dirtyLayers |= LAYER_CROP;
+        }
+
+        this->videoFrameRing.Publish(frame.slot);
+        this->publishSequence.fetch_add(1);
+        dirtyLayers |= LAYER_VIDEO;
+        this->heldFrames.pop_front();
     }
 
-    return 0;
+    // one refresh for everything published
+    if (dirtyLayers & LAYER_FACE)
+        this->refreshScheduler.MarkDirty(LAYER_FACE, &faceChanged);
+    if (dirtyLayers & LAYER_AUDIO)
+        this->refreshScheduler.MarkDirty(LAYER_AUDIO, &audioChanged);
+    if (dirtyLayers & LAYER_CROP)
+        this->refreshScheduler.MarkDirty(LAYER_CROP, &cropChanged);
+    if (dirtyLayers & LAYER_VIDEO)
+        this->refreshScheduler.MarkDirty(LAYER_VIDEO);
 }
 
-int uvdClient::drawAudioFrame()
+void uvdClient::onSyncTick(void *para)
 {
-    // draw audio
-    memset(this->pAudioFrameBufferRGB, 0x00, VIDEO_FRAME_SIZE_RGB);
-    memset(this->pAudioFrameBuffer, 0x00, VIDEO_FRAME_SIZE_RGBA);
-    
-    // this->audioPosition = 500;
+    uvdClient *pUvdClient = (uvdClient *)para;
+    Autolock lock(&pUvdClient->syncLock);
 
-/*
-    gDistortionPlayer.DistortXLine(this->pAudioFrameBufferRGB, this->audioPosition * 3 / 2, 4, 0xffff00ff);
+    pUvdClient->releaseVideoFrames();
+}
+
+int uvdClient::networkThread(void *para)
+{
+    uvdClient *pUvdClient = (uvdClient *)para;
+    SDL_Event event;
 
-    for (int i = 0; i < PIXEL_W; i++)
+    pUvdClient->videoStream = pUvdClient->netReactor.AddStream(pUvdClient->serverIP, VIDEO_PORT, pUvdClient->geometry.sizeNV12(),
+                                                               getVideoBuffer, onVideoFrame, pUvdClient, pUvdClient->streamMode);
+    if (pUvdClient->videoStream < 0)
     {
-        for (int j = 0; j < PIXEL_H; j++)
-        {
-            if (this->pAudioFrameBufferRGB[(j * PIXEL_W + i) * 3 + 0] > 40 ||
-                this->pAudioFrameBufferRGB[(j * PIXEL_W + i) * 3 + 1] > 40 ||
-                this->pAudioFrameBufferRGB[(j * PIXEL_W + i) * 3 + 2] > 40)
-            {
-                this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 0] = 0xa0;
-            }
-            else
-            {
-                this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 0] = 0x00;
-            }
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 1] = this->pAudioFrameBufferRGB[(j * PIXEL_W + i) * 3 + 0];
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 2] = this->pAudioFrameBufferRGB[(j * PIXEL_W + i) * 3 + 1];
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 3] = this->pAudioFrameBufferRGB[(j * PIXEL_W + i) * 3 + 2];
-        }
+        SDL_Log("video socket connect error.");
+        goto exit_with_err;
     }
-    */
+    SDL_Log("video socket connecting.");
 
-    if (this->audioPosition < 3 || this->audioPosition > 1280)
+    if (pUvdClient->netReactor.AddStream(pUvdClient->serverIP, FACE_PORT, sizeof(FaceFrame), getFaceBuffer, onFaceFrame, pUvdClient, pUvdClient->streamMode) < 0)
     {
-        SDL_Log("Audio Position < 3 or > 1280");
-        return -1;
+        SDL_Log("face socket connect error.");
+        goto exit_with_err;
     }
+    SDL_Log("face socket connecting.");
 
-    for (int i=(this->audioPosition - 2); i<this->audioPosition + 2; i++)
+    if (pUvdClient->netReactor.AddStream(pUvdClient->serverIP, AUDIO_PORT, sizeof(int), getAudioBuffer, onAudioFrame, pUvdClient, pUvdClient->streamMode) < 0)
     {
-        for (int j=0; j<PIXEL_H; j++)
-        {
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 0] = 0x7f;
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 1] = 0xff;
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 2] = 0xff;
-            this->pAudioFrameBuffer[(j * PIXEL_W + i) * 4 + 3] = 0x00;
-        }
+        SDL_Log("audio socket connect error.");
+        goto exit_with_err;
     }
+    SDL_Log("audio socket connecting.");
 
+    if (pUvdClient->netReactor.AddStream(pUvdClient->serverIP, CROP_PORT, sizeof(int) * 4, getCropBuffer, onCropFrame, pUvdClient, pUvdClient->streamMode) < 0)
+    {
+        SDL_Log("crop socket connect error.");
+        goto exit_with_err;
+    }
+    SDL_Log("crop socket connecting.");
+
+    // held frames run out of budget while no message comes in too
+    if (pUvdClient->syncBudget > 0)
+        pUvdClient->netReactor.SetTick(SYNC_TICK_MS, onSyncTick, pUvdClient);
+
+    // all four streams on this thread until Stop() or a socket fails
+    if (pUvdClient->netReactor.Run() == 0)
+    {
+        pUvdClient->netReactor.Close();
+        return 0;
+    }
+    SDL_Log("uvd socket, do not receive enough bytes, error.");
+
+exit_with_err:
+    pUvdClient->netReactor.Close();
+    event.type = SDL_QUIT;
+    SDL_PushEvent(&event);
+    return -1;
+}
+
+/*
+ * changed = area drawn before + area drawn now, then remember the new one
+ */
+static void updateDrawnRect(SDL_Rect *drawn, const SDL_Rect *now, SDL_Rect *changed)
+{
+    if (changed != NULL)
+        SDL_UnionRect(drawn, now, changed);
+    *drawn = *now;
+}
+
+/*
+ * Grow rect to cover [left, right) x [top, bottom)
+ */
+static void addDrawnArea(SDL_Rect *rect, int left, int top, int right, int bottom)
+{
+    SDL_Rect area;
+
+    area.x = left;
+    area.y = top;
+    area.w = right - left;
+    area.h = bottom - top;
+    SDL_UnionRect(rect, &area, rect);
+}
+
+/*
+ * Overlay layers are RGBA8888 g->width x g->height, a pixel is 4 bytes A, B, G, R.
+ * They are cleared once at allocation, after that every draw clears
+ * what it drew last time and writes whole row spans, never the full buffer.
+ */
+static bool clipArea(const FrameGeometry *g, int *left, int *top, int *right, int *bottom)
+{
+    if (*left < 0) *left = 0;
+    if (*top < 0) *top = 0;
+    if (*right > g->width) *right = g->width;
+    if (*bottom > g->height) *bottom = g->height;
+    return *left < *right && *top < *bottom;
+}
+
+static void clearArea(const FrameGeometry *g, unsigned char *buffer, const SDL_Rect *rect)
+{
+    int left = rect->x, top = rect->y, right = rect->x + rect->w, bottom = rect->y + rect->h;
+
+    if (!clipArea(g, &left, &top, &right, &bottom))
+        return;
+    for (int j = top; j < bottom; j++)
+        memset(buffer + (j * g->width + left) * 4, 0x00, (right - left) * 4);
+}
+
+/*
+ * [left, right) x [top, bottom) = a, b, g, r
+ */
+static void fillArea(const FrameGeometry *geometry, unsigned char *buffer, int left, int top, int right, int bottom,
+                     unsigned char a, unsigned char b, unsigned char g, unsigned char r)
+{
+    unsigned char pixel[4] = {a, b, g, r};
+    Uint32 value;
+
+    if (!clipArea(geometry, &left, &top, &right, &bottom))
+        return;
+    memcpy(&value, pixel, 4);
+    for (int j = top; j < bottom; j++)
+    {
+        Uint32 *row = (Uint32 *)(buffer + (j * geometry->width + left) * 4);
+        std::fill(row, row + (right - left), value);
+    }
+}
+
+/*
+ * Border of a box, the same pixels the old per-pixel test picked:
+ * k - left < n || right - k < n, i.e. n columns/rows on the left/top
+ * and n - 1 on the right/bottom
+ */
+static void fillBorder(const FrameGeometry *geometry, unsigned char *buffer, int left, int top, int right, int bottom, int n,
+                       unsigned char a, unsigned char b, unsigned char g, unsigned char r)
+{
+    int inTop = std::min(top + n, bottom);
+    int inBottom = std::max(bottom - (n - 1), inTop);
+
+    fillArea(geometry, buffer, left, top, right, inTop, a, b, g, r);
+    fillArea(geometry, buffer, left, inBottom, right, bottom, a, b, g, r);
+    fillArea(geometry, buffer, left, inTop, std::min(left + n, right), inBottom, a, b, g, r);
+    fillArea(geometry, buffer, std::max(right - (n - 1), left), inTop, right, inBottom, a, b, g, r);
+}
+
+int uvdClient::drawCropFrame(const int *cropPosition, SDL_Rect *changed)
+{
+    int left, top, right, bottom;
+    SDL_Rect drawn = {0, 0, 0, 0};
+    unsigned char *slot = this->cropLayerRing.GetWriteSlot();
+    int index = this->cropLayerRing.GetSlotIndex(slot);
+
+    clearArea(&this->geometry, slot, &this->cropSlotRect[index]);
+
+    if (cropPosition[3] != 0)
+    {
+        left = cropPosition[0];
+        top = cropPosition[1];
+        right = cropPosition[2];
+        bottom = cropPosition[3];
+
+        fillBorder(&this->geometry, slot, left, top, right, bottom, 4, 0xff, 0xff, 0x00, 0x00);
+        addDrawnArea(&drawn, left, top, right, bottom);
+    }
+
+    memcpy(slot + OVERLAY_SHAPE_OFFSET(this->geometry), cropPosition, sizeof(int) * 4);
+    this->cropSlotRect[index] = drawn;
+    this->cropLayerRing.Publish(slot);
+
+    updateDrawnRect(&this->cropDrawnRect, &drawn, changed);
     return 0;
 }
 
-int uvdClient::drawFaceFrame()
+int uvdClient::drawAudioFrame(int audioPosition, SDL_Rect *changed)
+{
+    SDL_Rect drawn = {0, 0, 0, 0};
+    unsigned char *slot = this->audioLayerRing.GetWriteSlot();
+    int index = this->audioLayerRing.GetSlotIndex(slot);
+    int ret = 0;
+
+    // draw audio
+    clearArea(&this->geometry, slot, &this->audioSlotRect[index]);
+
+    if (audioPosition < 3 || audioPosition > this->geometry.width)
+    {
+        SDL_Log("Audio Position < 3 or > %d", this->geometry.width);
+        ret = -1;
+    }
+    else
+    {
+        fillArea(&this->geometry, slot, audioPosition - 2, 0, audioPosition + 2, this->geometry.height, 0x7f, 0xff, 0xff, 0x00);
+        addDrawnArea(&drawn, audioPosition - 2, 0, audioPosition + 2, this->geometry.height);
+    }
+
+    memcpy(slot + OVERLAY_SHAPE_OFFSET(this->geometry), &audioPosition, sizeof(int));
+    this->audioSlotRect[index] = drawn;
+    this->audioLayerRing.Publish(slot);
+
+    updateDrawnRect(&this->audioDrawnRect, &drawn, changed);
+    return ret;
+}
+
+int uvdClient::drawFaceFrame(const FaceFrame *faceFrame, SDL_Rect *changed)
 {
+    SDL_Rect drawn = {0, 0, 0, 0};
+    unsigned char *slot = this->faceLayerRing.GetWriteSlot();
+    std::vector<SDL_Rect> &areas = this->faceDrawnAreas[this->faceLayerRing.GetSlotIndex(slot)];
+
     // draw face
-    memset(this->pFaceFrameBuffer, 0x00, VIDEO_FRAME_SIZE_RGBA);
+    for (size_t i = 0; i < areas.size(); i++)
+        clearArea(&this->geometry, slot, &areas[i]);
+    areas.clear();
 
+    // a pixel inside any box is 0x44 green, on any border 0xff green,
+    // whatever the order, so all fills go first and all borders after
     int left, top, right, bottom;
-    for (int i = 0; i < this->faceFrame.faceNumber; i++)
+    for (int i = 0; i < faceFrame->faceNumber; i++)
     {
-        left = this->faceFrame.facePosition[i][0];
-        top = this->faceFrame.facePosition[i][1];
-        right = this->faceFrame.facePosition[i][2];
-        bottom = this->faceFrame.facePosition[i][3];
+        left = faceFrame->facePosition[i][0];
+        top = faceFrame->facePosition[i][1];
+        right = faceFrame->facePosition[i][2];
+        bottom = faceFrame->facePosition[i][3];
 
-        for (int j = top; j < bottom; j++)
-        {
-            for (int k = left; k < right; k++)
-            {
-                this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 1] = 0x00;
-                this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 2] = 0xff;
-                this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 3] = 0x00;
-                if (this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 0] == 0xff)
-                {
-                    this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 0] = 0xff;
-                }
-                else
-                {
-                    this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 0] = 0x44;
-                }
+        fillArea(&this->geometry, slot, left, top, right, bottom, 0x44, 0x00, 0xff, 0x00);
 
-                if (k - left < 2 || right - k < 2 || j - top < 2 || bottom - j < 2)
-                {
-                    this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 0] = 0xff;
-                    this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 1] = 0x00;
-                    this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 2] = 0xff;
-                    this->pFaceFrameBuffer[(j * PIXEL_W + k) * 4 + 3] = 0x00;
-                }
-            }
-        }
+        SDL_Rect box = {left, top, right - left, bottom - top};
+        areas.push_back(box);
+        addDrawnArea(&drawn, left, top, right, bottom);
+    }
+
+    for (int i = 0; i < faceFrame->faceNumber; i++)
+    {
+        left = faceFrame->facePosition[i][0];
+        top = faceFrame->facePosition[i][1];
+        right = faceFrame->facePosition[i][2];
+        bottom = faceFrame->facePosition[i][3];
+
+        fillBorder(&this->geometry, slot, left, top, right, bottom, 2, 0xff, 0x00, 0xff, 0x00);
     }
 
-    Mat src(PIXEL_H, PIXEL_W, CV_8UC4, this->pFaceFrameBuffer);
+    Mat src(this->geometry.height, this->geometry.width, CV_8UC4, slot);
 
-    for (int i = 0; i < this->faceFrame.faceNumber; i ++)
+    for (int i = 0; i < faceFrame->faceNumber; i ++)
     {
-        string strInfo  = "(";
-        strInfo += std::to_string(this->faceFrame.facePosition[i][0]);
-        strInfo += ",";
-        strInfo += std::to_string(this->faceFrame.facePosition[i][1]);
-        strInfo += ",";
-        strInfo += std::to_string(this->faceFrame.facePosition[i][2] - this->faceFrame.facePosition[i][0]);
-        strInfo += ",";
-        strInfo += std::to_string(this->faceFrame.facePosition[i][3] - this->faceFrame.facePosition[i][1]);
-        strInfo += ")";
-        putText(src, strInfo, Point(this->faceFrame.facePosition[i][0], this->faceFrame.facePosition[i][1] - 10), FONT_HERSHEY_SIMPLEX, 0.5, cvScalar(255, 0, 255, 0), 2, 4);
+        string strInfo = faceLabelText(faceFrame->facePosition[i]);
+        putText(src, strInfo, faceLabelOrigin(faceFrame->facePosition[i]), FONT_HERSHEY_SIMPLEX, FACE_LABEL_SCALE, cvScalar(255, 0, 255, 0), FACE_LABEL_THICKNESS, 4);
+
+        SDL_Rect label = faceLabelRect(faceFrame->facePosition[i], strInfo);
+        areas.push_back(label);
+        addDrawnArea(&drawn, label.x, label.y, label.x + label.w, label.y + label.h);
     }
 
+    memcpy(slot + OVERLAY_SHAPE_OFFSET(this->geometry), faceFrame, sizeof(FaceFrame));
+    this->faceLayerRing.Publish(slot);
+
+    updateDrawnRect(&this->faceDrawnRect, &drawn, changed);
     return 0;
 }
 
+/*
+ * Ruler of the current scale, hidden if rulerShown is off
+ * the distorted grid comes memoized per size and spacing, switching is a redraw of spans
+ */
 int uvdClient::drawRulerFrame()
 {
-    // draw ruler
-    int left, top, right, bottom;
-    for (int i=0; i<11; i++)
+    const RulerGrid *grid = NULL;
+    unsigned int generation = gDistortionPlayer.GetCalibrationGeneration();
+
+    // the grid of a former calibration is not used any more, it is freed
+    // by a later reload, wipe its spans with the whole layer instead
+    if (generation != this->rulerGeneration && this->rulerGrid != NULL)
     {
-        left = PIXEL_W / 2 - 1 + 112 * (i-5);
-        top = 0;
-        right = PIXEL_W / 2 + 112 * (i-5);
-        bottom = PIXEL_H;
-        for (int j=top; j<bottom; j++)
-        {
-            for (int k=left; k<right; k++)
-            {
-                this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 0] = 0xff;
-                this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 1] = 0x00;
-                this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 2] = 0xff;
-            }
-        }
+        memset(this->pRulerFrameBufferRGBA, 0, this->geometry.sizeRGBA());
+        this->rulerGrid = NULL;
     }
+    this->rulerGeneration = generation;
 
-    for (int i=0; i<11; i++)
+    if (this->rulerShown)
     {
-        left = 0;
-        top = PIXEL_H / 2 - 1 + 63 * (i-5);
-        right = PIXEL_W;
-        bottom = PIXEL_H / 2 + 63 * (i-5);
-        for (int j=top; j<bottom; j++)
+        grid = gDistortionPlayer.DistortRuler(this->geometry.width, this->geometry.height, RULER_STEP_X * this->rulerScale, RULER_STEP_Y * this->rulerScale);
+        if (grid == NULL)
         {
-            for (int k=left; k<right; k++)
-            {
-                this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 0] = 0xff;
-                this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 1] = 0x00;
-                this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 2] = 0xff;
-            }
+            SDL_Log("ruler of scale %d error.", this->rulerScale);
+            return -1;
         }
     }
 
-    left = PIXEL_W / 2 - 4;
-    top = PIXEL_H / 2 - 4;
-    right = PIXEL_W / 2 + 4;
-    bottom = PIXEL_H / 2 + 4;
-    for (int j=top; j<bottom; j++)
+    if (this->rulerGrid != NULL)
+        this->rulerGrid->Clear(this->pRulerFrameBufferRGBA);
+    if (grid != NULL)
+        grid->Draw(this->pRulerFrameBufferRGBA);
+    this->rulerGrid = grid;
+
+    return 0;
+}
+
+unsigned char *uvdClient::getFaceBuffer(void *para)
+{
+    return (unsigned char *)&((uvdClient *)para)->faceFrame;
+}
+
+void uvdClient::onFaceFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr)
+{
+    uvdClient *pUvdClient = (uvdClient *)para;
+    int faces = (size - (int)sizeof(int)) / (int)sizeof(pUvdClient->faceFrame.facePosition[0]);
+
+    if (size == 0)
     {
-        for (int k=left; k<right; k++)
+        // heartbeat: no change up to its time
+        if (pUvdClient->syncBudget > 0)
         {
-            this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 0] = 0xff;
-            this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 1] = 0x00;
-            this->pRulerFrameBufferRGB[(j * PIXEL_W + k) * 3 + 2] = 0xff;
+            Autolock lock(&pUvdClient->syncLock);
+            pUvdClient->faceJitter.Advance(captureTime(hdr));
+            pUvdClient->releaseVideoFrames();
         }
+        return;
     }
 
-    gDistortionPlayer.DistortImageRGB(this->pRulerFrameBufferRGB, PIXEL_W, PIXEL_H, this->pRulerFrameBufferRGB_After, PIXEL_W, PIXEL_H);
-    for (int i=0; i<PIXEL_H; i++)
+    // a framed one may end after the last box
+    if (size < (int)sizeof(int) || pUvdClient->faceFrame.faceNumber < 0 || pUvdClient->faceFrame.faceNumber > faces)
     {
-        for (int j=0; j<PIXEL_W; j++)
-        {
-            this->pRulerFrameBufferRGBA[(i * PIXEL_W + j) * 4 + 1] = this->pRulerFrameBufferRGB_After[(i * PIXEL_W + j) * 3 + 0];
-            this->pRulerFrameBufferRGBA[(i * PIXEL_W + j) * 4 + 2] = this->pRulerFrameBufferRGB_After[(i * PIXEL_W + j) * 3 + 1];
-            this->pRulerFrameBufferRGBA[(i * PIXEL_W + j) * 4 + 3] = this->pRulerFrameBufferRGB_After[(i * PIXEL_W + j) * 3 + 2];
-
-            if ( this->pRulerFrameBufferRGB_After[(i * PIXEL_W + j) * 3 + 0] > 0x40  ||
-                 this->pRulerFrameBufferRGB_After[(i * PIXEL_W + j) * 3 + 1] > 0x40  ||
-                 this->pRulerFrameBufferRGB_After[(i * PIXEL_W + j) * 3 + 2] > 0x40 )
-            {   
-                this->pRulerFrameBufferRGBA[(i * PIXEL_W + j) * 4 + 0] = 0x80;
-            }
-            else
-            {
-                this->pRulerFrameBufferRGBA[(i * PIXEL_W + j) * 4 + 0] = 0x00;
-            }
-        }
+        SDL_Log("face frame of %d bytes with %d faces, dropped.", size, size < (int)sizeof(int) ? 0 : pUvdClient->faceFrame.faceNumber);
+        return;
     }
 
-    return 0;
+    SDL_Log("faceNumber: %d, facePosition[0][0]: %d", pUvdClient->faceFrame.faceNumber, pUvdClient->faceFrame.facePosition[0][0]);
+    if (pUvdClient->syncBudget > 0)
+    {
+        // drawn with the video frame of its time
+        Autolock lock(&pUvdClient->syncLock);
+        pUvdClient->faceJitter.Push(captureTime(hdr), pUvdClient->faceFrame);
+        pUvdClient->releaseVideoFrames();
+        return;
+    }
+
+    SDL_Rect changed;
+    pUvdClient->drawFaceFrame(&pUvdClient->faceFrame, &changed);
+    pUvdClient->refreshScheduler.MarkDirty(LAYER_FACE, &changed);
 }
 
-int uvdClient::getFaceFrameThread(void *para)
+unsigned char *uvdClient::getAudioBuffer(void *para)
+{
+    return (unsigned char *)&((uvdClient *)para)->audioPosition;
+}
+
+void uvdClient::onAudioFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr)
 {
     uvdClient *pUvdClient = (uvdClient *)para;
-    struct sockaddr_in face_address;
-    int face_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    face_address.sin_family = AF_INET;
-    face_address.sin_addr.s_addr = inet_addr(pUvdClient->serverIP);
-    face_address.sin_port = htons(FACE_PORT);
 
-    SDL_Event event;
-    
-    if (connect(face_sockfd, (struct sockaddr *)&face_address, sizeof(sockaddr_in)) == -1)
+    if (size == 0)
     {
-        SDL_Log("face socket connect error.");
-        event.type = SDL_QUIT;
-        SDL_PushEvent(&event);
-        return -1;
+        if (pUvdClient->syncBudget > 0)
+        {
+            Autolock lock(&pUvdClient->syncLock);
+            pUvdClient->audioJitter.Advance(captureTime(hdr));
+            pUvdClient->releaseVideoFrames();
+        }
+        return;
     }
-    else
+
+    if (size != sizeof(int))
     {
-        SDL_Log("face socket connect success.");
+        SDL_Log("audio frame of %d bytes, dropped.", size);
+        return;
     }
 
-    while(1)
+    SDL_Log("audio position: %d", pUvdClient->audioPosition);
+    if (pUvdClient->syncBudget > 0)
     {
-        if (recv(face_sockfd, (char *)&(pUvdClient->faceFrame), sizeof(FaceFrame), MSG_WAITALL) == sizeof(FaceFrame))
-        {
-            SDL_Log("faceNumber: %d, facePosition[0][0]: %d", pUvdClient->faceFrame.faceNumber, pUvdClient->faceFrame.facePosition[0][0]);
-            pUvdClient->drawFaceFrame();
-            event.type = REFRESH_EVENT;
-            SDL_PushEvent(&event);
-        }
+        Autolock lock(&pUvdClient->syncLock);
+        pUvdClient->audioJitter.Push(captureTime(hdr), pUvdClient->audioPosition);
+        pUvdClient->releaseVideoFrames();
+        return;
     }
-    
-    return 0;
+
+    SDL_Rect changed;
+    pUvdClient->drawAudioFrame(pUvdClient->audioPosition, &changed);
+    pUvdClient->refreshScheduler.MarkDirty(LAYER_AUDIO, &changed);
 }
 
-int uvdClient::getAudioFrameThread(void *para)
+unsigned char *uvdClient::getCropBuffer(void *para)
+{
+    return (unsigned char *)((uvdClient *)para)->cropPosition;
+}
+
+void uvdClient::onCropFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr)
 {
     uvdClient *pUvdClient = (uvdClient *)para;
-    struct sockaddr_in audio_address;
-    int audio_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    audio_address.sin_family = AF_INET;
-    audio_address.sin_addr.s_addr = inet_addr(pUvdClient->serverIP);
-    audio_address.sin_port = htons(AUDIO_PORT);
 
-    SDL_Event event;
+    if (size == 0)
+    {
+        if (pUvdClient->syncBudget > 0)
+        {
+            Autolock lock(&pUvdClient->syncLock);
+            pUvdClient->cropJitter.Advance(captureTime(hdr));
+            pUvdClient->releaseVideoFrames();
+        }
+        return;
+    }
 
-    if (connect(audio_sockfd, (struct sockaddr *)&audio_address, sizeof(sockaddr_in)) == -1)
+    if (size != sizeof(int) * 4)
     {
-        SDL_Log("audio socket connect error.");
-        event.type = SDL_QUIT;
-        SDL_PushEvent(&event);
-        return -1;
+        SDL_Log("crop frame of %d bytes, dropped.", size);
+        return;
     }
-    else
+
+    SDL_Log("cropPosition[0]: %d", pUvdClient->cropPosition[0]);
+    if (pUvdClient->syncBudget > 0)
     {
-        SDL_Log("audio socket connect success.");
+        CropShape crop;
+
+        memcpy(crop.position, pUvdClient->cropPosition, sizeof(crop.position));
+        Autolock lock(&pUvdClient->syncLock);
+        pUvdClient->cropJitter.Push(captureTime(hdr), crop);
+        pUvdClient->releaseVideoFrames();
+        return;
     }
 
-    while(1)
+    SDL_Rect changed;
+    pUvdClient->drawCropFrame(pUvdClient->cropPosition, &changed);
+    pUvdClient->refreshScheduler.MarkDirty(LAYER_CROP, &changed);
+}
+
+void uvdClient::onCalibration(void *para)
+{
+    uvdClient *pUvdClient = (uvdClient *)para;
+
+    // the ruler is redrawn by the refresh, the video is corrected again anyway
+    pUvdClient->refreshScheduler.MarkDirty(LAYER_ALL);
+}
+
+/*
+ * <server ip> [-v WxH] [-o WxH] [-p raw|framed] [-c nv12|jpeg] [-s ms] [calibration file]
+ *  -v: video frame from the server, -o: corrected frame of the distortion window
+ *  -p: stream protocol, legacy raw messages or framed with a StreamFrameHeader
+ *  -c: video payload, JPEG needs framed streams
+ *  -s: latency budget, hold video up to ms for the metadata of its capture time
+ */
+int uvdClient::parseArgs(char **argv, const char **calibration)
+{
+    this->geometry.width = DEFAULT_PIXEL_W;
+    this->geometry.height = DEFAULT_PIXEL_H;
+    this->geometry.correctedWidth = DEFAULT_CORRECTED_W;
+    this->geometry.correctedHeight = DEFAULT_CORRECTED_H;
+    this->streamMode = STREAM_RAW;
+    this->videoFormat = STREAM_FORMAT_NV12;
+    this->syncBudget = 0;
+    *calibration = NULL;
+
+    if (argv[1] == NULL || strlen(argv[1]) >= sizeof(this->serverIP))
+        goto usage;
+    memset(this->serverIP, 0x00, sizeof(this->serverIP));
+    memcpy(this->serverIP, argv[1], strlen(argv[1]));
+
+    for (int i = 2; argv[i] != NULL; i++)
     {
-        if (recv(audio_sockfd, (char *)&(pUvdClient->audioPosition), sizeof(int), MSG_WAITALL) == sizeof(int))
+        if (strcmp(argv[i], "-v") == 0)
         {
-            SDL_Log("audio position: %d", pUvdClient->audioPosition);
-            pUvdClient->drawAudioFrame();
-            event.type = REFRESH_EVENT;
-            SDL_PushEvent(&event);
+            if (!parseFrameSize(argv[++i], &this->geometry.width, &this->geometry.height))
+                goto usage;
+        }
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            if (!parseFrameSize(argv[++i], &this->geometry.correctedWidth, &this->geometry.correctedHeight))
+                goto usage;
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            i++;
+            if (argv[i] != NULL && strcmp(argv[i], "raw") == 0)
+                this->streamMode = STREAM_RAW;
+            else if (argv[i] != NULL && strcmp(argv[i], "framed") == 0)
+                this->streamMode = STREAM_FRAMED;
+            else
+                goto usage;
+        }
+        else if (strcmp(argv[i], "-c") == 0)
+        {
+            i++;
+            if (argv[i] != NULL && strcmp(argv[i], "nv12") == 0)
+                this->videoFormat = STREAM_FORMAT_NV12;
+            else if (argv[i] != NULL && strcmp(argv[i], "jpeg") == 0)
+                this->videoFormat = STREAM_FORMAT_JPEG;
+            else
+                goto usage;
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            char tail;
+
+            i++;
+            if (argv[i] == NULL || sscanf(argv[i], "%d%c", &this->syncBudget, &tail) != 1 ||
+                this->syncBudget < 1 || this->syncBudget > SYNC_BUDGET_MAX)
+                goto usage;
+        }
+        else if (*calibration == NULL)
+        {
+            *calibration = argv[i];
+        }
+        else
+        {
+            goto usage;
         }
     }
 
+    // a JPEG frame has no fixed size, only a header tells where it ends
+    if (this->videoFormat == STREAM_FORMAT_JPEG && this->streamMode != STREAM_FRAMED)
+        goto usage;
+    // so does a capture timestamp
+    if (this->syncBudget > 0 && this->streamMode != STREAM_FRAMED)
+        goto usage;
     return 0;
-}
 
-int uvdClient::getCropFrameThread(void *para)
-{
-	uvdClient *pUvdClient = (uvdClient *)para;
-	struct sockaddr_in crop_address;
-	int crop_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	crop_address.sin_family = AF_INET;
-	crop_address.sin_addr.s_addr = inet_addr(pUvdClient->serverIP);
-	crop_address.sin_port = htons(CROP_PORT);
-
-	SDL_Event event;
-	
-	if (connect(crop_sockfd, (struct sockaddr *)&crop_address, sizeof(sockaddr_in)) == -1)
-	{
-		SDL_Log("crop socket connect error.");
-		event.type = SDL_QUIT;
-		SDL_PushEvent(&event);
-		return -1;
-	}
-	else
-	{
-		SDL_Log("crop socket connect success");
-	}
-	
-	while (1)
-	{
-		if (recv(crop_sockfd, (char *)pUvdClient->cropPosition, sizeof(int) * 4, MSG_WAITALL) == sizeof(int) * 4)
-		{
-            SDL_Log("cropPosition[0]: %d", pUvdClient->cropPosition[0]);
-			pUvdClient->drawCropFrame();
-			event.type = REFRESH_EVENT;
-			SDL_PushEvent(&event);
-		}
-	}
+usage:
+    SDL_Log("usage: %s <server ip> [-v WxH] [-o WxH] [-p raw|framed] [-c nv12|jpeg] [-s ms] [calibration file], "
+            "even sizes up to %d, default -v %dx%d -o %dx%d -p raw -c nv12, no -s, -s 1 to %d ms, "
+            "-c jpeg and -s need -p framed",
+            argv[0], FRAME_MAX_SIZE, DEFAULT_PIXEL_W, DEFAULT_PIXEL_H, DEFAULT_CORRECTED_W, DEFAULT_CORRECTED_H,
+            SYNC_BUDGET_MAX);
+    return -1;
 }
 
 int uvdClient::start(char **argv)
 {
+    const char *calibration;
+
+    if (this->parseArgs(argv, &calibration) < 0)
+        return -1;
+
     if (SDL_Init(SDL_INIT_VIDEO) == -1)
     {
         SDL_Log("SDL_Init() Error, error info: %s", SDL_GetError());
         return -1;
     }
-
-    pthread_mutex_init(&gMutex, NULL);
-
-    memset(this->serverIP, 0x00, 256);
-	memcpy(this->serverIP, argv[1], strlen(argv[1]));
+    SDL_Log("video %dx%d %s, corrected %dx%d, %s streams.", this->geometry.width, this->geometry.height,
+            this->videoFormat == STREAM_FORMAT_JPEG ? "JPEG" : "NV12",
+            this->geometry.correctedWidth, this->geometry.correctedHeight,
+            this->streamMode == STREAM_FRAMED ? "framed" : "raw");
+    if (this->syncBudget > 0)
+        SDL_Log("video held up to %d ms for face, audio and crop of its time.", this->syncBudget);
 
     this->faceFrame.faceNumber = 0;
     this->audioPosition = 0;
     this->cropPosition[0] = 0;
+    memset(&this->faceDrawnRect, 0x00, sizeof(SDL_Rect));
+    memset(&this->audioDrawnRect, 0x00, sizeof(SDL_Rect));
+    memset(&this->cropDrawnRect, 0x00, sizeof(SDL_Rect));
+    for (int i = 0; i < OVERLAY_SLOT_NUMBER; i++)
+    {
+        this->faceDrawnAreas[i].reserve(MAX_FACE * 2);
+        memset(&this->audioSlotRect[i], 0x00, sizeof(SDL_Rect));
+        memset(&this->cropSlotRect[i], 0x00, sizeof(SDL_Rect));
+    }
 
-    this->currentFocusWindow = 0;
-    this->dropFrameNumber = 0;
+    this->rulerGrid = NULL;
+    this->rulerShown = true;
+    this->rulerScale = RULER_SCALE;
+    this->rulerGeneration = 0;
+    this->publishSequence.store(0);
 
-    this->pVideoFrameBuffer = (unsigned char *)malloc(VIDEO_FRAME_SIZE_NV12 * VIDEO_FRAME_BUFFER_NUMBER);
-    if (this->pVideoFrameBuffer == NULL)
+    // lens lookups at the native camera resolution, before any calibration is loaded
+    if (!gDistortionPlayer.SetGeometry(this->geometry.width, this->geometry.height,
+                                       this->geometry.correctedWidth, this->geometry.correctedHeight))
     {
-        SDL_Log("malloc video frame buffer error.");
+        SDL_Log("distortion player geometry error.");
         return -1;
     }
 
-    this->pVideoFrameBufferTemp = (unsigned char *)malloc(VIDEO_FRAME_SIZE_NV12);
-    if (this->pVideoFrameBufferTemp == NULL)
+    // optional lens calibration file, reloaded whenever it changes
+    if (calibration != NULL)
     {
-        SDL_Log("malloc video frame buffer temp error.");
+        if (!gDistortionPlayer.LoadCalibration(calibration))
+            SDL_Log("lens calibration %s error, built-in lens.", calibration);
+        if (!gDistortionPlayer.WatchCalibration(calibration, onCalibration, this))
+            SDL_Log("watch lens calibration %s error.", calibration);
+    }
+
+    this->currentFocusWindow = 0;
+    this->dropFrameNumber = 0;
+    this->videoStream = -1;
+    this->badVideoFrames = 0;
+    this->lateFrames = 0;
+
+    // held frames take slots of their own
+    this->videoFrameBufferNumber = VIDEO_FRAME_BUFFER_NUMBER;
+    if (this->syncBudget > 0)
+        this->videoFrameBufferNumber = std::max(VIDEO_FRAME_BUFFER_NUMBER, SYNC_MAX_FRAMES + 3);
+
+    this->pVideoFrameBuffer = (unsigned char *)malloc(this->geometry.sizeNV12() * this->videoFrameBufferNumber);
+    if (this->pVideoFrameBuffer == NULL)
+    {
+        SDL_Log("malloc video frame buffer error.");
         return -1;
     }
 
-    this->pRulerFrameBufferRGB = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGB);
-    if (this->pRulerFrameBufferRGB == NULL)
+    if (!this->videoFrameRing.init(this->pVideoFrameBuffer, this->videoFrameBufferNumber, this->geometry.sizeNV12()))
     {
-        SDL_Log("malloc ruler frame buffer RGB error.");
+        SDL_Log("init video frame ring error.");
         return -1;
     }
 
-    this->pRulerFrameBufferRGB_After = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGB);
-    if (this->pRulerFrameBufferRGB_After == NULL)
+    // a compressed frame is smaller than the raw one, or not worth compressing
+    if (this->videoFormat == STREAM_FORMAT_JPEG &&
+        !this->videoDecoder.Start(std::max(1, std::min((int)sysconf(_SC_NPROCESSORS_ONLN) / 2, VIDEO_DECODER_MAX)),
+                                  this->geometry.sizeNV12(), this->geometry.width, this->geometry.height,
+                                  onVideoDecoded, this))
     {
-        SDL_Log("malloc ruler frame buffer RGB After error.");
+        SDL_Log("start video decoder error.");
         return -1;
     }
 
-    this->pRulerFrameBufferRGBA = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGBA);
+    this->pRulerFrameBufferRGBA = (unsigned char *)calloc(1, this->geometry.sizeRGBA()); // spans only
     if (this->pRulerFrameBufferRGBA == NULL)
     {
         SDL_Log("malloc ruler frame buffer RGBA error.");
         return -1;
     }
 
-    this->pFaceFrameBuffer = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGBA);
+    this->pFaceFrameBuffer = (unsigned char *)calloc(OVERLAY_SLOT_NUMBER, FACE_SLOT_SIZE(this->geometry)); // draws only clear what they drew
     if (this->pFaceFrameBuffer == NULL)
     {
         SDL_Log("malloc face frame buffer error.");
         return -1;
     }
+
+    if (!this->faceLayerRing.init(this->pFaceFrameBuffer, OVERLAY_SLOT_NUMBER, FACE_SLOT_SIZE(this->geometry)))
+    {
+        SDL_Log("init face layer ring error.");
+        return -1;
+    }
     
-    this->pAudioFrameBuffer = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGBA);
+    this->pAudioFrameBuffer = (unsigned char *)calloc(OVERLAY_SLOT_NUMBER, AUDIO_SLOT_SIZE(this->geometry)); // draws only clear what they drew
     if (this->pAudioFrameBuffer == NULL)
     {
         SDL_Log("malloc audio frame buffer error.");
         return -1;
     }
 
-    this->pAudioFrameBufferRGB = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGB);
-    if (this->pAudioFrameBufferRGB == NULL)
+    if (!this->audioLayerRing.init(this->pAudioFrameBuffer, OVERLAY_SLOT_NUMBER, AUDIO_SLOT_SIZE(this->geometry)))
     {
-        SDL_Log("malloc audio frame buffer rgb error.");
+        SDL_Log("init audio layer ring error.");
         return -1;
     }
 
-    this->pCropFrameBuffer = (unsigned char *)malloc(VIDEO_FRAME_SIZE_RGBA);
+    this->pCropFrameBuffer = (unsigned char *)calloc(OVERLAY_SLOT_NUMBER, CROP_SLOT_SIZE(this->geometry)); // draws only clear what they drew
     if (this->pCropFrameBuffer == NULL)
     {
         SDL_Log("malloc crop frame buffer error.");
         return -1;
     }
 
-    this->myOriginWindow.init(PIXEL_W, PIXEL_H);
-    this->myDistortionWindow.init(PIXEL_W, PIXEL_H);
+    if (!this->cropLayerRing.init(this->pCropFrameBuffer, OVERLAY_SLOT_NUMBER, CROP_SLOT_SIZE(this->geometry)))
+    {
+        SDL_Log("init crop layer ring error.");
+        return -1;
+    }
+
+    this->myOriginWindow.init(this->geometry.width, this->geometry.height);
+    this->myDistortionWindow.init(this->geometry.width, this->geometry.height,
+                                  this->geometry.correctedWidth, this->geometry.correctedHeight);
 
     this->drawRulerFrame();
+    this->refreshScheduler.init(REFRESH_EVENT, this->geometry.width, this->geometry.height, LAYER_ALL); // textures start empty
     // unsigned long tick1 = gDistortionPlayer.GetTickCount();
     // this->drawAudioFrame();
     // SDL_Log("audio draw cost time: %d", gDistortionPlayer.GetTickCount() - tick1);
 
-    SDL_Thread *video_socket_thread = SDL_CreateThread(this->getVideoFrameThread, NULL, this);
-    SDL_Thread *face_socket_thread = SDL_CreateThread(this->getFaceFrameThread, NULL, this);
-    SDL_Thread *audio_socket_thread = SDL_CreateThread(this->getAudioFrameThread, NULL, this);
-    SDL_Thread *crop_socket_thread = SDL_CreateThread(this->getCropFrameThread, NULL, this);
+    SDL_Thread *network_thread = SDL_CreateThread(this->networkThread, NULL, this);
 
     SDL_Event event;
 
@@ -484,51 +880,129 @@ int uvdClient::start(char **argv)
         if (event.type == SDL_QUIT)
         {
             SDL_Log("SDL_QUIT.");
+            this->netReactor.Stop();
+            SDL_WaitThread(network_thread, NULL);
+            this->videoDecoder.Stop();
             break;
         }
         else if (event.type == REFRESH_EVENT)
         {
+            // everything changed since the last redraw, coalesced
+            SDL_Rect dirtyRects[REFRESH_MAX_LAYER];
+
+            // a reloaded lens warps the ruler differently
+            if (this->rulerGeneration != gDistortionPlayer.GetCalibrationGeneration())
+            {
+                this->drawRulerFrame();
+                this->refreshScheduler.MarkDirty(LAYER_RULER);
+            }
+
+            unsigned int dirtyLayers = this->refreshScheduler.TakeDirty(dirtyRects);
+            if (dirtyLayers == 0)
+                continue;
+
+            // newest complete frame and overlays, kept by the rings until the next refresh,
+            // each overlay with the geometry it was drawn from, all of one held frame
+            unsigned char *pVideoFrame, *pFaceLayer, *pAudioLayer, *pCropLayer;
+            unsigned int sequence;
+            do
+            {
+                while ((sequence = this->publishSequence.load()) & 1)
+                {
+                    SDL_Delay(0); // a frame is half published
+                }
+                pVideoFrame = this->videoFrameRing.GetLatest();
+                pFaceLayer = this->faceLayerRing.GetLatest();
+                pAudioLayer = this->audioLayerRing.GetLatest();
+                pCropLayer = this->cropLayerRing.GetLatest();
+            } while (sequence != this->publishSequence.load());
+            memcpy(&this->overlayShapes.faceFrame, pFaceLayer + OVERLAY_SHAPE_OFFSET(this->geometry), sizeof(FaceFrame));
+            memcpy(&this->overlayShapes.audioPosition, pAudioLayer + OVERLAY_SHAPE_OFFSET(this->geometry), sizeof(int));
+            memcpy(this->overlayShapes.cropPosition, pCropLayer + OVERLAY_SHAPE_OFFSET(this->geometry), sizeof(int) * 4);
+
             switch(this->currentFocusWindow)
             {
                 case 0:
                 this->myOriginWindow.handleEvent(
                     event, 
-                    this->pVideoFrameBuffer,
+                    dirtyLayers,
+                    dirtyRects,
+                    pVideoFrame,
                     this->pRulerFrameBufferRGBA,
-                    this->pFaceFrameBuffer,
-                    this->pAudioFrameBuffer,
-                    this->pCropFrameBuffer
+                    pFaceLayer,
+                    pAudioLayer,
+                    pCropLayer
                     );
                 this->myDistortionWindow.handleEvent(
                     event,
-                    this->pVideoFrameBuffer,
+                    dirtyLayers,
+                    dirtyRects,
+                    &this->overlayShapes,
+                    pVideoFrame,
                     this->pRulerFrameBufferRGBA,
-                    this->pFaceFrameBuffer,
-                    this->pAudioFrameBuffer,
-                    this->pCropFrameBuffer
+                    pFaceLayer,
+                    pAudioLayer,
+                    pCropLayer
                     );
                 break;
 
                 case 1:
                 this->myOriginWindow.handleEvent(
                     event, 
-                    this->pVideoFrameBuffer,
+                    dirtyLayers,
+                    dirtyRects,
+                    pVideoFrame,
                     this->pRulerFrameBufferRGBA,
-                    this->pFaceFrameBuffer,
-                    this->pAudioFrameBuffer,
-                    this->pCropFrameBuffer
+                    pFaceLayer,
+                    pAudioLayer,
+                    pCropLayer
                     );
                 this->myDistortionWindow.handleEvent(
                     event,
-                    this->pVideoFrameBuffer,
+                    dirtyLayers,
+                    dirtyRects,
+                    &this->overlayShapes,
+                    pVideoFrame,
                     this->pRulerFrameBufferRGBA,
-                    this->pFaceFrameBuffer,
-                    this->pAudioFrameBuffer,
-                    this->pCropFrameBuffer
+                    pFaceLayer,
+                    pAudioLayer,
+                    pCropLayer
                     );
                 break;
         }
         }
+        else if (event.type == SDL_KEYDOWN)
+        {
+            // r: show/hide the ruler, +/-: grid spacing
+            int scale = this->rulerScale;
+            bool shown = this->rulerShown;
+
+            switch (event.key.keysym.sym)
+            {
+                case SDLK_r:
+                shown = !shown;
+                break;
+
+                case SDLK_EQUALS:
+                case SDLK_PLUS:
+                case SDLK_KP_PLUS:
+                scale = std::min(scale + 1, RULER_SCALE_MAX);
+                break;
+
+                case SDLK_MINUS:
+                case SDLK_KP_MINUS:
+                scale = std::max(scale - 1, RULER_SCALE_MIN);
+                break;
+            }
+
+            if (scale != this->rulerScale || shown != this->rulerShown)
+            {
+                this->rulerScale = scale;
+                this->rulerShown = shown;
+                this->drawRulerFrame();
+                this->refreshScheduler.MarkDirty(LAYER_RULER);
+            }
+        }
         else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_FOCUS_GAINED)
         {
             SDL_Log("SDL_WINDOWEVENT_FOCUS_GAINED, which window: %d", event.window.windowID);
@@ -536,6 +1010,8 @@ int uvdClient::start(char **argv)
         }
         else
         {
+            // SDL only pumps events on this thread, e.g. those of a
+            // PLAYERWND player window end up here too
             // SDL_Log("Other SDL Event, Do not care.");
         }
     }
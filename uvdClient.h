@@ -2,26 +2,94 @@
 #ifndef UVDCLIENT_H
 #define UVDCLIENT_H
 
+#include <vector>
+#include <deque>
+#include <atomic>
 #include "common.h"
+#include "framering.h"
+#include "netreactor.h"
+#include "framedecoder.h"
+#include "jitterbuffer.h"
+#include "autolock.h"
+#include "refreshscheduler.h"
+
+// an overlay slot is the RGBA layer of geometry g followed by the shapes it was drawn from
+#define OVERLAY_SHAPE_OFFSET(g) ((g).sizeRGBA())
+#define FACE_SLOT_SIZE(g) ((g).sizeRGBA() + sizeof(FaceFrame))
+#define AUDIO_SLOT_SIZE(g) ((g).sizeRGBA() + sizeof(int))
+#define CROP_SLOT_SIZE(g) ((g).sizeRGBA() + sizeof(int) * 4)
+
+// a crop message, kept by value in its jitter buffer
+struct CropShape
+{
+    int position[4];
+};
+
+// a video frame in the ring waiting for the metadata of its time
+struct HeldFrame
+{
+    unsigned char *slot;
+    uint64_t timestamp; // capture time
+    Uint32 held; // SDL_GetTicks() when it was held
+};
 
 class uvdClient
 {
 private:
 	char serverIP[256];
+    FrameGeometry geometry; // from the command line, fixed once started
+    int streamMode; // STREAM_RAW or STREAM_FRAMED, all four streams
+    int videoFormat; // STREAM_FORMAT_NV12, or STREAM_FORMAT_JPEG on a framed stream
 
     int videoFrameBufferNumber;
-    unsigned char *pVideoFrameBufferTemp;
-
-    // RGB -> RGB_After -> RGBA
-    unsigned char *pRulerFrameBufferRGB;
-    unsigned char *pRulerFrameBufferRGB_After;
-
-    unsigned char *pAudioFrameBufferRGB;
-
+    FrameRing videoFrameRing; // slots of pVideoFrameBuffer
+    NetReactor netReactor;
+    RefreshScheduler refreshScheduler; // one REFRESH_EVENT queued at most
+    int videoStream; // reactor index of the video stream
+    unsigned int badVideoFrames; // framed ones of another size or format
+    FrameDecoder videoDecoder; // JPEG video back to NV12 into videoFrameRing
+
+    // -s: frames are held until the face, audio and crop of their capture
+    // time are in, or syncBudget ms at most, 0 shows everything on arrival
+    int syncBudget;
+    MutexLock syncLock; // protect the held frames, the jitter buffers and videoFrameRing writes
+    std::deque<HeldFrame> heldFrames; // oldest first
+    JitterBuffer<FaceFrame, SYNC_JITTER_ENTRIES> faceJitter;
+    JitterBuffer<int, SYNC_JITTER_ENTRIES> audioJitter;
+    JitterBuffer<CropShape, SYNC_JITTER_ENTRIES> cropJitter;
+    unsigned int lateFrames; // shown before all of their metadata was in
+    // odd while a held frame and its overlays are being published, the
+    // renderer takes the four slots again if it moved in between
+    std::atomic<unsigned int> publishSequence;
+
+    const RulerGrid *rulerGrid; // spans in pRulerFrameBufferRGBA, NULL if none
+    bool rulerShown;
+    int rulerScale; // spacing is RULER_STEP_X/Y times this
+    unsigned int rulerGeneration; // lens calibration the ruler was drawn with
+
+    // received on the network thread only, the renderer reads the
+    // copy published in the overlay slots
     FaceFrame faceFrame;
     int audioPosition;
     int cropPosition[4];
 
+    // slots of pFaceFrameBuffer, pAudioFrameBuffer and pCropFrameBuffer,
+    // drawn into a free slot then published, nobody waits on anybody
+    FrameRing faceLayerRing;
+    FrameRing audioLayerRing;
+    FrameRing cropLayerRing;
+
+    SDL_Rect faceDrawnRect; // area the latest published slot has pixels in
+    SDL_Rect audioDrawnRect;
+    SDL_Rect cropDrawnRect;
+
+    // what every slot has drawn, cleared when the slot is drawn again
+    std::vector<SDL_Rect> faceDrawnAreas[OVERLAY_SLOT_NUMBER]; // every box and label
+    SDL_Rect audioSlotRect[OVERLAY_SLOT_NUMBER];
+    SDL_Rect cropSlotRect[OVERLAY_SLOT_NUMBER];
+
+    OverlayShapes overlayShapes; // taken at every refresh
+
     originWindow myOriginWindow;
     distortionWindow myDistortionWindow;
 
@@ -29,15 +97,33 @@ private:
 
     int dropFrameNumber;
 
+    int parseArgs(char **argv, const char **calibration);
 	int drawRulerFrame();
-    int drawFaceFrame();
-    int drawAudioFrame();
-    int drawCropFrame();
-
-    static int getVideoFrameThread(void *para);
-    static int getFaceFrameThread(void *para);
-    static int getAudioFrameThread(void *para);
-    static int getCropFrameThread(void *para);
+    // draw into a free slot and publish it
+    // changed: area to upload, what the latest slot had plus what is drawn now
+    int drawFaceFrame(const FaceFrame *faceFrame, SDL_Rect *changed);
+    int drawAudioFrame(int audioPosition, SDL_Rect *changed);
+    int drawCropFrame(const int *cropPosition, SDL_Rect *changed);
+
+    // -s, under syncLock
+    void holdVideoFrame(unsigned char *slot, uint64_t timestamp);
+    void releaseVideoFrames();
+
+    // one reactor thread for all streams, handlers run on it
+    static int networkThread(void *para);
+    static unsigned char *getVideoBuffer(void *para);
+    static void onVideoFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr);
+    static void onVideoDecoded(void *para, const unsigned char *nv12, uint32_t sequence, uint64_t timestamp);
+    static unsigned char *getFaceBuffer(void *para);
+    static void onFaceFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr);
+    static unsigned char *getAudioBuffer(void *para);
+    static void onAudioFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr);
+    static unsigned char *getCropBuffer(void *para);
+    static void onCropFrame(void *para, unsigned char *msg, int size, const StreamFrameHeader *hdr);
+    // held frames past the budget, on the network thread
+    static void onSyncTick(void *para);
+    // lens calibration reloaded, on the watcher thread
+    static void onCalibration(void *para);
 
 public:
 
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2018 Polycom Inc
+ *
+ * Worker Pool
+ *
+ * Persistent threads splitting a job of rows into horizontal bands.
+ * Band k of n is always [rows*k/n, rows*(k+1)/n), so the result does
+ * not depend on scheduling as long as bands write disjoint rows.
+ *
+ * Date Created: 20261017
+ */
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <vector>
+#include "autolock.h"
+
+#define MAX_WORKER 16
+
+/*
+ * band: 0 .. GetThreadCount()-1, e.g. to pick scratch memory of its own
+ */
+typedef void (*BAND_PROC_CB)(void *ctx, int band, int row_begin, int row_end);
+
+class WorkerPool
+{
+public:
+    WorkerPool()
+    {
+        count = 1;
+        generation = 0;
+        pending = 0;
+        quit = false;
+        job_cb = NULL;
+        job_ctx = NULL;
+        job_rows = 0;
+        pthread_mutex_init(&mtx, NULL);
+        pthread_cond_init(&work_cond, NULL);
+        pthread_cond_init(&done_cond, NULL);
+    }
+
+    virtual ~WorkerPool()
+    {
+        stop_workers();
+        pthread_mutex_destroy(&mtx);
+        pthread_cond_destroy(&work_cond);
+        pthread_cond_destroy(&done_cond);
+    }
+
+    /*
+     * Number of bands per job, the calling thread works on one of them
+     *  n - 1 threads are kept waiting for jobs
+     */
+    bool SetThreadCount(int n)
+    {
+        Autolock lock(&run_mtx);
+
+        if(n < 1)
+            n = 1;
+        if(n > MAX_WORKER)
+            n = MAX_WORKER;
+        if(n == count)
+            return true;
+
+        stop_workers();
+
+        args.resize(n);
+        tids.resize(n);
+        quit = false;
+
+        for(int k = 1; k < n; k++)
+        {
+            args[k].pool = this;
+            args[k].index = k;
+            args[k].seen = generation; // no job can start before we return
+            if(0 != pthread_create(&tids[k], NULL, worker_proc, &args[k]))
+            {
+                printf("error: failed to create worker thread %d.\n", k);
+                count = k; // keep what has been started
+                return false;
+            }
+        }
+
+        count = n;
+        return true;
+    }
+
+    int GetThreadCount()
+    {
+        return count;
+    }
+
+    /*
+     * Run cb over rows [0, rows) and return when every band is done
+     */
+    void Run(BAND_PROC_CB cb, void *ctx, int rows)
+    {
+        Autolock lock(&run_mtx); // one job at a time
+
+        if(count == 1)
+        {
+            cb(ctx, 0, 0, rows);
+            return;
+        }
+
+        pthread_mutex_lock(&mtx);
+        job_cb = cb;
+        job_ctx = ctx;
+        job_rows = rows;
+        pending = count - 1;
+        generation++;
+        pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&mtx);
+
+        // band 0 on the calling thread
+        cb(ctx, 0, 0, rows / count);
+
+        pthread_mutex_lock(&mtx);
+        while(pending > 0)
+            pthread_cond_wait(&done_cond, &mtx);
+        pthread_mutex_unlock(&mtx);
+    }
+
+private:
+    struct WorkerArg
+    {
+        WorkerPool *pool;
+        int index;
+        unsigned int seen; // last job generation handled
+    };
+
+    static void *worker_proc(void *ctx)
+    {
+        WorkerArg *arg = (WorkerArg *)ctx;
+        WorkerPool *pthis = arg->pool;
+        unsigned int seen = arg->seen;
+
+        pthread_mutex_lock(&pthis->mtx);
+
+        while(1)
+        {
+            while(!pthis->quit && pthis->generation == seen)
+                pthread_cond_wait(&pthis->work_cond, &pthis->mtx);
+            if(pthis->quit)
+                break;
+
+            seen = pthis->generation;
+            BAND_PROC_CB cb = pthis->job_cb;
+            void *jobctx = pthis->job_ctx;
+            int rows = pthis->job_rows;
+            int n = pthis->count;
+            pthread_mutex_unlock(&pthis->mtx);
+
+            cb(jobctx, arg->index, rows * arg->index / n, rows * (arg->index + 1) / n);
+
+            pthread_mutex_lock(&pthis->mtx);
+            if(--pthis->pending == 0)
+                pthread_cond_signal(&pthis->done_cond);
+        }
+
+        pthread_mutex_unlock(&pthis->mtx);
+        return NULL;
+    }
+
+    void stop_workers()
+    {
+        pthread_mutex_lock(&mtx);
+        quit = true;
+        pthread_cond_broadcast(&work_cond);
+        pthread_mutex_unlock(&mtx);
+
+        for(int k = 1; k < count; k++)
+            pthread_join(tids[k], NULL);
+
+        count = 1;
+    }
+
+private:
+    MutexLock run_mtx; // serialize Run and SetThreadCount
+    pthread_mutex_t mtx; // protect job knowledge below
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    std::vector<pthread_t> tids;
+    std::vector<WorkerArg> args;
+    int count; // bands per job, including the calling thread
+    unsigned int generation; // bumped for every job
+    int pending; // workers still running the current job
+    bool quit;
+    BAND_PROC_CB job_cb;
+    void *job_ctx;
+    int job_rows;
+};
+
+#endif